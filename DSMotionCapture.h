@@ -0,0 +1,30 @@
+#ifndef DSMotionCapture_H
+#define DSMotionCapture_H
+
+/*
+ * Capture file written by the kernel plugin when "ux0:data/dsmotion/capture.bin" exists at startup.
+ * Each startup appends a header, then each accepted HID report is appended as a record header
+ * immediately followed by "size" bytes of the raw report (DS3 0x01, DS4 0x11 or DualSense 0x31).
+ * "device" is the controller index given by the kernel plugin.
+ * Timestamps and device indexes start over after each header. A header can't be read as a record:
+ * its "size" byte (version) is smaller than any report.
+ */
+
+#define DS_CAPTURE_MAGIC   0x50434D44 // "DMCP"
+#define DS_CAPTURE_VERSION 3
+#define DS_CAPTURE_MIN_REPORT_SIZE 32
+
+struct dsCaptureHeader
+{
+    unsigned int magic;
+    unsigned int version;
+};
+
+struct dsCaptureRecord
+{
+    unsigned int timestamp;
+    unsigned char size;
+    unsigned char device;
+} __attribute__((packed));
+
+#endif
@@ -1,6 +1,20 @@
 #ifndef DSMotionLibrary_H
 #define DSMotionLibrary_H
 
+#define DS_MAX_DEVICES 4
+
+// Device index for the first connected controller
+#define DS_PRIMARY_DEVICE 0xFFFFFFFF
+
+#define DS_DEVICE_NONE 0
+#define DS_DEVICE_DS3  1
+#define DS_DEVICE_DS4  2
+#define DS_DEVICE_DUALSENSE 3
+
+// Accelerometer value of 1G in samples: DS3 samples are not scaled like DS4 and DualSense ones
+#define DS_ACCEL_ONE_G     0x2000
+#define DS_ACCEL_ONE_G_DS3 (113/4)
+
 struct accelGyroData
 {
     signed short accel[3];
@@ -9,10 +23,226 @@ struct accelGyroData
     unsigned int counter;
 };
 
+// Must be a power of 2: sample counter gives the ring slot
+#ifndef DS_HISTORY_SIZE
+#define DS_HISTORY_SIZE 512
+#endif
+
+// Must be a power of 2, touch state of about one second for DS4 packet rate
+#ifndef DS_TOUCH_HISTORY_SIZE
+#define DS_TOUCH_HISTORY_SIZE 256
+#endif
+
+// DS4 touchpad coordinates
+#define DS_TOUCH_MAX_FINGERS 2
+#define DS_TOUCH_WIDTH  1920
+#define DS_TOUCH_HEIGHT 943
+
+struct dsTouchFinger
+{
+    unsigned short x;
+    unsigned short y;
+    unsigned char id;     // Changes with each new contact
+    unsigned char active;
+    unsigned short reserved;
+};
+
+struct dsTouchData
+{
+    struct dsTouchFinger fingers[DS_TOUCH_MAX_FINGERS];
+    unsigned long long timestamp; // Controller time, same time base as sceKernelGetSystemTimeWide
+    unsigned int counter;
+    unsigned int reserved;
+};
+
+/*
+ * Running sums of all samples since connection, stored alongside each ring slot:
+ * the sum over any window inside the ring is a single subtraction.
+ * Unsigned wrapping is fine since window sums always fit in 32 bits.
+ */
+struct accelGyroSum
+{
+    unsigned int accel[3];
+    unsigned int gyro[3];
+};
+
+struct accelGyroValues
+{
+    signed short accel[3];
+    signed short gyro[3];
+};
+
+#define DS_FILTER_BOX               0 // Average over the given window
+#define DS_FILTER_EMA               1 // Exponential moving average with the given time constant
+#define DS_FILTER_CRITICALLY_DAMPED 2 // Second order without overshoot: two chained EMAs of half the time constant
+#define DS_FILTER_ONE_EURO          3 // EMA whose cutoff frequency increases with speed
+
+struct dsFilterParams
+{
+    int type;
+    unsigned int timeConstantUS;   // Box window or smoothing time constant
+    unsigned int minCutoffMilliHz; // One euro only: cutoff frequency at rest
+    unsigned int beta;             // One euro only: cutoff increase in mHz per 1000 units/s
+};
+
+// Filter of processes which haven't set one (see dsSetFilter)
+#define DS_DEFAULT_FILTER_TIME_US 100000
+
+#define DS_MAX_FILTERS 8
+
+// Filter output after the most recent sample of a device, written like ring slots
+struct dsFilterOutput
+{
+    volatile unsigned int counter;    // Sample counter, 0 while written
+    volatile unsigned int generation; // Filter generation it was computed with
+    struct accelGyroValues values;
+};
+
+/*
+ * Filter set by one process: recursive filters are updated by the kernel plugin with each sample,
+ * box filter is computed at read time from the running sums.
+ */
+struct dsSharedFilter
+{
+    volatile int pid; // 0 if free, negative while set
+    volatile unsigned int generation; // Changes with each setting
+    struct dsFilterParams params;
+    struct dsFilterOutput outputs[DS_MAX_DEVICES];
+};
+
+/*
+ * Orientation computed by the kernel plugin with each sample, in SceMotion default axes.
+ * Values are fixed point Q30 (1 << 30 is 1.0).
+ */
+#define DS_ORIENTATION_ONE (1 << 30)
+
+struct dsQuaternion
+{
+    int x;
+    int y;
+    int z;
+    int w;
+};
+
+struct dsOrientation
+{
+    struct dsQuaternion quat;
+    int matrix[9]; // Rotation matrix, row after row
+};
+
+struct dsSharedDevice
+{
+    volatile int type;
+    volatile unsigned int generation; // Changes with each connection, counters start over
+    volatile unsigned int counter;
+    struct accelGyroData data[DS_HISTORY_SIZE];
+    struct accelGyroSum sums[DS_HISTORY_SIZE];
+    unsigned long long timestamps[DS_HISTORY_SIZE];   // 64 bits sample times, same time base as sceKernelGetSystemTimeWide
+    struct dsQuaternion orientations[DS_HISTORY_SIZE];
+
+    // DS4 touchpad state with each report, written and read like samples
+    volatile unsigned int touchCounter;
+    struct dsTouchData touches[DS_TOUCH_HISTORY_SIZE];
+};
+
+#define DS_SHARED_VERSION 8
+
+/*
+ * Sample rings published read-only to user processes (see DSMotionRing.h to read them).
+ * Ring sizes can be changed at build time: readers check them along with the version.
+ */
+struct dsSharedMemory
+{
+    unsigned int version;
+    unsigned int size;              // sizeof(struct dsSharedMemory)
+    unsigned int historySize;       // DS_HISTORY_SIZE
+    unsigned int touchHistorySize;  // DS_TOUCH_HISTORY_SIZE
+    volatile int primaryDevice;
+    struct dsSharedFilter filters[DS_MAX_FILTERS];
+    struct dsSharedDevice devices[DS_MAX_DEVICES];
+};
+
+// Time window in microseconds (same time base as sceKernelGetSystemTimeWide), end excluded
+struct dsTimeRange
+{
+    unsigned long long start;
+    unsigned long long end;
+};
+
+#define DS_STATS_REPORT_IDS 16
+#define DS_STATS_LATENCY_BUCKETS 8
+
+struct dsStats
+{
+    // Reports are counted by report ID high nibble (DS3: 0x01, DS4: 0x11, DualSense: 0x31)
+    unsigned int acceptedReports[DS_STATS_REPORT_IDS];
+    unsigned int rejectedReports[DS_STATS_REPORT_IDS];
+
+    unsigned int smallBuffers;       // HID transfers with a buffer too small for a motion report
+    unsigned int cancelledTransfers; // Pending receive buffers dropped by 0x0B/0x0C events
+    unsigned int unreadOverwrites;   // Samples overwritten before a dsGetNewAccelGyro reader got them (summed over readers)
+    unsigned int droppedCaptures;    // Accepted reports left out of the capture file because its I/O thread was late
+
+    unsigned int connections;
+    unsigned int reconnections;
+    unsigned int disconnections;
+
+    // Intervals between accepted reports (in microseconds)
+    unsigned int minInterval;
+    unsigned int maxInterval;
+    unsigned int meanInterval;
+    unsigned int meanJitter;
+
+    // BlueTooth event hook duration: bucket 0 counts durations under 1us, bucket N from 2^(N-1) to 2^N-1us (last one also counts longer ones)
+    unsigned int hookLatency[DS_STATS_LATENCY_BUCKETS];
+};
+
 unsigned int dsGetCurrentTimestamp();
 unsigned int dsGetCurrentCounter();
 
 unsigned int dsGetSampledAccelGyro(unsigned int iSamplingTimeMS, signed short oAccel[3], signed short oGyro[3]);
 int dsGetInstantAccelGyro(unsigned int iIndex, struct accelGyroData* oData);
+int dsGetAccelGyroHistory(unsigned int iStart, unsigned int iCount, struct accelGyroData* oData);
+int dsGetAccelGyroRange(const struct dsTimeRange* iRange, unsigned int iMaxCount, struct accelGyroData* oData);
+
+// Samples not read yet by the calling process (oldest first), "oLost" gets the number of samples overwritten before being read
+int dsGetNewAccelGyro(unsigned int iMaxCount, struct accelGyroData* oData, unsigned int* oLost);
+
+unsigned int dsGetConnectedDevices();
+int dsGetDeviceType(unsigned int iDevice);
+unsigned int dsGetDeviceCounter(unsigned int iDevice);
+unsigned int dsGetDeviceGeneration(unsigned int iDevice);
+unsigned int dsGetDeviceSampledAccelGyro(unsigned int iDevice, unsigned int iSamplingTimeMS, signed short oAccel[3], signed short oGyro[3]);
+int dsGetDeviceAccelGyroHistory(unsigned int iDevice, unsigned int iStart, unsigned int iCount, struct accelGyroData* oData);
+int dsGetDeviceNewAccelGyro(unsigned int iDevice, unsigned int iMaxCount, struct accelGyroData* oData, unsigned int* oLost);
+int dsGetDeviceAccelGyroRange(unsigned int iDevice, const struct dsTimeRange* iRange, unsigned int iMaxCount, struct accelGyroData* oData);
+int dsGetDeviceResampledAccelGyro(unsigned int iDevice, unsigned int iPeriodUS, unsigned int iCount, struct accelGyroData* oData);
+
+// Filter of the calling process: the least recently set one of another process is replaced if there is no free slot
+int dsSetFilter(const struct dsFilterParams* iParams);
+unsigned int dsGetFilteredAccelGyro(signed short oAccel[3], signed short oGyro[3]);
+unsigned int dsGetDeviceFilteredAccelGyro(unsigned int iDevice, signed short oAccel[3], signed short oGyro[3]);
+
+// Orientation after the most recent sample: returns its counter, 0 if there is no sample
+unsigned int dsGetOrientation(struct dsOrientation* oOrientation);
+unsigned int dsGetDeviceOrientation(unsigned int iDevice, struct dsOrientation* oOrientation);
+
+// Most recent touchpad states (oldest first): returns the number of copied states
+int dsGetTouchHistory(unsigned int iCount, struct dsTouchData* oData);
+int dsGetDeviceTouchHistory(unsigned int iDevice, unsigned int iCount, struct dsTouchData* oData);
+
+#define DS_WAIT_INFINITE 0xFFFFFFFF
+
+// Blocks until the device counter differs from "iLastCounter": returns 1 with the new counter in "oCounter" (if not NULL),
+// 0 on timeout, a negative value if the device is not connected or disconnects (or reconnects) meanwhile
+int dsWaitForSample(unsigned int iDevice, unsigned int iLastCounter, unsigned int iTimeoutUS, unsigned int* oCounter);
+
+const struct dsSharedMemory* dsGetSharedMemory();
+
+// Adds a user event (DS_TRACE_USER_FIRST or more, see DSMotionTrace.h): returns a negative value if tracing is off
+int dsTrace(unsigned int iEvent, int iArg0, int iArg1, int iArg2);
+
+int dsGetStats(struct dsStats* oStats);
+int dsResetStats();
 
 #endif
@@ -0,0 +1,397 @@
+#ifndef DSMotionRing_H
+#define DSMotionRing_H
+
+#include <string.h>
+#include "DSMotionLibrary.h"
+
+/*
+ * Lock-free reading of a controller sample ring, shared by the kernel plugin exports
+ * and by the user plugin reading the shared memory directly.
+ * The ring is written by the kernel BlueTooth hook only: a slot counter is cleared while
+ * the slot is written and published afterwards, then the ring counter gives the most
+ * recent complete slot. A read is valid if the slot counter is the expected one
+ * before and after the copy.
+ */
+
+_Static_assert((DS_HISTORY_SIZE & (DS_HISTORY_SIZE-1)) == 0, "DS_HISTORY_SIZE must be a power of 2");
+_Static_assert((DS_TOUCH_HISTORY_SIZE & (DS_TOUCH_HISTORY_SIZE-1)) == 0, "DS_TOUCH_HISTORY_SIZE must be a power of 2");
+
+#define DS_HISTORY_MASK (DS_HISTORY_SIZE-1)
+#define DS_TOUCH_HISTORY_MASK (DS_TOUCH_HISTORY_SIZE-1)
+#define DS_READ_RETRIES 4
+
+#define dsMemoryBarrier() __sync_synchronize()
+
+static inline const volatile struct accelGyroData* dsGetSampleSlot(const struct dsSharedDevice* iRing, unsigned int iCounter)
+{
+    return &iRing->data[iCounter & DS_HISTORY_MASK];
+}
+
+// Returns 0 if the sample with the given counter has been overwritten (or is being overwritten)
+static inline int dsReadSample(const struct dsSharedDevice* iRing, unsigned int iCounter, struct accelGyroData* oData)
+{
+    const volatile struct accelGyroData* slot = dsGetSampleSlot(iRing, iCounter);
+    if (0 == iCounter || slot->counter != iCounter)
+        return 0;
+
+    dsMemoryBarrier();
+    memcpy(oData, (const void *)slot, sizeof(struct accelGyroData));
+    dsMemoryBarrier();
+
+    return slot->counter == iCounter;
+}
+
+static inline int dsReadSampleSum(const struct dsSharedDevice* iRing, unsigned int iCounter, struct accelGyroSum* oSum)
+{
+    // Sum before the first sample of the connection
+    if (0 == iCounter)
+    {
+        memset(oSum, 0, sizeof(struct accelGyroSum));
+        return 1;
+    }
+
+    const volatile struct accelGyroData* slot = dsGetSampleSlot(iRing, iCounter);
+    if (slot->counter != iCounter)
+        return 0;
+
+    dsMemoryBarrier();
+    memcpy(oSum, &iRing->sums[iCounter & DS_HISTORY_MASK], sizeof(struct accelGyroSum));
+    dsMemoryBarrier();
+
+    return slot->counter == iCounter;
+}
+
+static inline int dsReadSampleTimestamp(const struct dsSharedDevice* iRing, unsigned int iCounter, unsigned int* oTimestamp)
+{
+    const volatile struct accelGyroData* slot = dsGetSampleSlot(iRing, iCounter);
+    if (0 == iCounter || slot->counter != iCounter)
+        return 0;
+
+    dsMemoryBarrier();
+    *oTimestamp = slot->timestamp;
+    dsMemoryBarrier();
+
+    return slot->counter == iCounter;
+}
+
+static inline int dsReadSampleWideTimestamp(const struct dsSharedDevice* iRing, unsigned int iCounter, unsigned long long* oTimestamp)
+{
+    const volatile struct accelGyroData* slot = dsGetSampleSlot(iRing, iCounter);
+    if (0 == iCounter || slot->counter != iCounter)
+        return 0;
+
+    dsMemoryBarrier();
+    *oTimestamp = iRing->timestamps[iCounter & DS_HISTORY_MASK];
+    dsMemoryBarrier();
+
+    return slot->counter == iCounter;
+}
+
+// Oldest sample counter still in the ring when the most recent one is "iLastCounter"
+static inline unsigned int dsGetOldestCounter(unsigned int iLastCounter)
+{
+    return (iLastCounter > DS_HISTORY_SIZE) ? iLastCounter-DS_HISTORY_SIZE+1 : 1;
+}
+
+/*
+ * Binary search of the first sample at or after the given time, among samples up to "iLastCounter".
+ * Returns "iLastCounter"+1 if all samples are older.
+ * Samples being overwritten are considered as older than any time.
+ */
+static inline unsigned int dsFindSampleAtOrAfter(const struct dsSharedDevice* iRing, unsigned long long iTime, unsigned int iLastCounter)
+{
+    unsigned int minCounter = dsGetOldestCounter(iLastCounter);
+    unsigned int maxCounter = iLastCounter+1;
+
+    while (minCounter < maxCounter)
+    {
+        unsigned int midCounter = minCounter + (maxCounter-minCounter)/2;
+
+        unsigned long long timestamp;
+        if (dsReadSampleWideTimestamp(iRing, midCounter, &timestamp) && timestamp >= iTime)
+            maxCounter = midCounter;
+        else
+            minCounter = midCounter+1;
+    }
+
+    return minCounter;
+}
+
+// Returns the counter of the most recent sample (0 if there is none)
+static inline unsigned int dsReadLastSample(const struct dsSharedDevice* iRing, struct accelGyroData* oData)
+{
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = iRing->counter;
+        if (0 == lastCounter)
+            return 0;
+
+        if (dsReadSample(iRing, lastCounter, oData))
+            return lastCounter;
+    }
+
+    return 0;
+}
+
+/*
+ * Average of the samples received during the given time before the most recent one:
+ * binary search of the oldest sample inside the window (the sum before it must still be in the ring)
+ * then difference of the running sums. Returns the number of averaged samples.
+ */
+static inline int dsReadWindowAverage(const struct dsSharedDevice* iRing, unsigned int iWindowUS, signed short oAccel[3], signed short oGyro[3], unsigned int* oLastCounter)
+{
+    struct accelGyroData data;
+    unsigned int lastCounter = dsReadLastSample(iRing, &data);
+    if (0 == lastCounter)
+        return 0;
+
+    unsigned int initTime = data.timestamp;
+
+    unsigned int firstCounter = lastCounter;
+    unsigned int minCounter = (lastCounter >= DS_HISTORY_SIZE) ? lastCounter-DS_HISTORY_SIZE+2 : 1;
+    while (minCounter < firstCounter)
+    {
+        unsigned int midCounter = minCounter + (firstCounter-minCounter)/2;
+
+        unsigned int timestamp;
+        if (dsReadSampleTimestamp(iRing, midCounter, &timestamp) && initTime-timestamp <= iWindowUS)
+            firstCounter = midCounter;
+        else
+            minCounter = midCounter+1;
+    }
+
+    struct accelGyroSum lastSum;
+    struct accelGyroSum prevSum;
+    if (!dsReadSampleSum(iRing, lastCounter, &lastSum) || !dsReadSampleSum(iRing, firstCounter-1, &prevSum))
+        return 0;
+
+    int nbSamples = lastCounter-firstCounter+1;
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        oAccel[i] = (int)(lastSum.accel[i]-prevSum.accel[i]) / nbSamples;
+        oGyro[i] = (int)(lastSum.gyro[i]-prevSum.gyro[i]) / nbSamples;
+    }
+
+    if (NULL != oLastCounter)
+        *oLastCounter = lastCounter;
+
+    return nbSamples;
+}
+
+// Filter set by a process, NULL if it has none (default box filter)
+static inline const struct dsSharedFilter* dsFindFilter(const struct dsSharedMemory* iShared, int iPid)
+{
+    for (int i = 0 ; i < DS_MAX_FILTERS ; i++)
+    {
+        if (iShared->filters[i].pid == iPid)
+            return &iShared->filters[i];
+    }
+    return NULL;
+}
+
+/*
+ * Filter output of the most recent sample of a device for the process "iPid": box filter is computed
+ * at read time from the running sums, other filters are updated by the kernel plugin with each sample.
+ * Until the first sample after the filter is set, the most recent sample is given as it is.
+ * Returns 0 if there is no sample.
+ */
+static inline int dsReadFiltered(const struct dsSharedMemory* iShared, int iPid, unsigned int iDevice, signed short oAccel[3], signed short oGyro[3], unsigned int* oLastCounter)
+{
+    const struct dsSharedDevice* ring = &iShared->devices[iDevice];
+    const struct dsSharedFilter* filter = dsFindFilter(iShared, iPid);
+    if (NULL == filter)
+        return dsReadWindowAverage(ring, DS_DEFAULT_FILTER_TIME_US, oAccel, oGyro, oLastCounter);
+
+    const volatile struct dsFilterOutput* output = &filter->outputs[iDevice];
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int generation = filter->generation;
+        unsigned int counter = output->counter;
+        dsMemoryBarrier();
+
+        struct dsFilterParams params;
+        struct accelGyroValues values;
+        memcpy(&params, &filter->params, sizeof(params));
+        memcpy(&values, (const void *)&output->values, sizeof(values));
+        unsigned int outputGeneration = output->generation;
+        dsMemoryBarrier();
+
+        // Slot given to another process meanwhile
+        if (filter->pid != iPid)
+            return dsReadWindowAverage(ring, DS_DEFAULT_FILTER_TIME_US, oAccel, oGyro, oLastCounter);
+        if (filter->generation != generation || output->counter != counter)
+            continue;
+
+        if (DS_FILTER_BOX == params.type)
+            return dsReadWindowAverage(ring, params.timeConstantUS, oAccel, oGyro, oLastCounter);
+
+        if (outputGeneration != generation)
+        {
+            struct accelGyroData data;
+            if (!dsReadLastSample(ring, &data))
+                return 0;
+
+            memcpy(oAccel, data.accel, sizeof(data.accel));
+            memcpy(oGyro, data.gyro, sizeof(data.gyro));
+            if (NULL != oLastCounter)
+                *oLastCounter = data.counter;
+            return data.counter;
+        }
+        if (0 == counter)
+            continue;
+
+        memcpy(oAccel, values.accel, sizeof(values.accel));
+        memcpy(oGyro, values.gyro, sizeof(values.gyro));
+        if (NULL != oLastCounter)
+            *oLastCounter = counter;
+        return counter;
+    }
+
+    return 0;
+}
+
+// Orientation after the most recent sample: returns 0 if there is no sample
+static inline int dsReadOrientation(const struct dsSharedDevice* iRing, struct dsQuaternion* oQuat, unsigned int* oLastCounter)
+{
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = iRing->counter;
+        if (0 == lastCounter)
+            return 0;
+
+        const volatile struct accelGyroData* slot = dsGetSampleSlot(iRing, lastCounter);
+        if (slot->counter != lastCounter)
+            continue;
+
+        struct dsQuaternion quat;
+        dsMemoryBarrier();
+        memcpy(&quat, &iRing->orientations[lastCounter & DS_HISTORY_MASK], sizeof(quat));
+        dsMemoryBarrier();
+
+        if (slot->counter == lastCounter)
+        {
+            *oQuat = quat;
+            if (NULL != oLastCounter)
+                *oLastCounter = lastCounter;
+            return lastCounter;
+        }
+    }
+
+    return 0;
+}
+
+// Copies "iCount" samples from "iFirstCounter": returns 0 if they have been overwritten during the copy
+static inline int dsCopySamples(const struct dsSharedDevice* iRing, unsigned int iFirstCounter, unsigned int iCount, struct accelGyroData* oData)
+{
+    const volatile struct accelGyroData* firstSlot = dsGetSampleSlot(iRing, iFirstCounter);
+    if (firstSlot->counter != iFirstCounter)
+        return 0;
+    dsMemoryBarrier();
+
+    unsigned int firstIndex = iFirstCounter & DS_HISTORY_MASK;
+    unsigned int firstPart = (firstIndex+iCount <= DS_HISTORY_SIZE) ? iCount : DS_HISTORY_SIZE-firstIndex;
+    memcpy(oData, &iRing->data[firstIndex], firstPart*sizeof(struct accelGyroData));
+    if (firstPart < iCount)
+        memcpy(&oData[firstPart], &iRing->data[0], (iCount-firstPart)*sizeof(struct accelGyroData));
+
+    // Slots are overwritten from the oldest one: if it is intact, the whole copy is intact
+    dsMemoryBarrier();
+    return firstSlot->counter == iFirstCounter;
+}
+
+/*
+ * Copies up to "iCount" samples ending "iStart" samples before the most recent one,
+ * from the oldest to the most recent one. Returns the number of copied samples.
+ */
+static inline int dsReadHistory(const struct dsSharedDevice* iRing, unsigned int iStart, unsigned int iCount, struct accelGyroData* oData)
+{
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = iRing->counter;
+
+        unsigned int available = (lastCounter > DS_HISTORY_SIZE) ? DS_HISTORY_SIZE : lastCounter;
+        if (iStart >= available)
+            return 0;
+
+        unsigned int count = (iCount > available-iStart) ? available-iStart : iCount;
+        if (0 == count)
+            return 0;
+
+        if (dsCopySamples(iRing, lastCounter-iStart-count+1, count, oData))
+            return count;
+    }
+
+    return 0;
+}
+
+/*
+ * Counters of the samples inside the given time range (at most "iMaxCount" oldest ones).
+ * Returns the number of samples, which start from "*oFirstCounter".
+ */
+static inline unsigned int dsFindRange(const struct dsSharedDevice* iRing, const struct dsTimeRange* iRange, unsigned int iMaxCount, unsigned int iLastCounter, unsigned int* oFirstCounter)
+{
+    if (0 == iLastCounter || iRange->end <= iRange->start)
+        return 0;
+
+    unsigned int firstCounter = dsFindSampleAtOrAfter(iRing, iRange->start, iLastCounter);
+    unsigned int endCounter = dsFindSampleAtOrAfter(iRing, iRange->end, iLastCounter);
+    if (endCounter <= firstCounter)
+        return 0;
+
+    *oFirstCounter = firstCounter;
+    return (endCounter-firstCounter > iMaxCount) ? iMaxCount : endCounter-firstCounter;
+}
+
+// Copies the samples inside the given time range, from the oldest to the most recent one
+static inline int dsReadRange(const struct dsSharedDevice* iRing, const struct dsTimeRange* iRange, unsigned int iMaxCount, struct accelGyroData* oData)
+{
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int firstCounter;
+        unsigned int count = dsFindRange(iRing, iRange, iMaxCount, iRing->counter, &firstCounter);
+        if (0 == count)
+            return 0;
+
+        if (dsCopySamples(iRing, firstCounter, count, oData))
+            return count;
+    }
+
+    return 0;
+}
+
+/*
+ * Copies up to "iCount" most recent touch states, from the oldest to the most recent one.
+ * Touch slots are cleared and published like sample slots.
+ */
+static inline int dsReadTouchHistory(const struct dsSharedDevice* iRing, unsigned int iCount, struct dsTouchData* oData)
+{
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = iRing->touchCounter;
+        unsigned int count = (lastCounter < DS_TOUCH_HISTORY_SIZE) ? lastCounter : DS_TOUCH_HISTORY_SIZE;
+        if (count > iCount)
+            count = iCount;
+        if (0 == count)
+            return 0;
+
+        unsigned int firstCounter = lastCounter-count+1;
+        const volatile struct dsTouchData* firstSlot = &iRing->touches[firstCounter & DS_TOUCH_HISTORY_MASK];
+        if (firstSlot->counter != firstCounter)
+            continue;
+        dsMemoryBarrier();
+
+        unsigned int firstIndex = firstCounter & DS_TOUCH_HISTORY_MASK;
+        unsigned int firstPart = (firstIndex+count <= DS_TOUCH_HISTORY_SIZE) ? count : DS_TOUCH_HISTORY_SIZE-firstIndex;
+        memcpy(oData, &iRing->touches[firstIndex], firstPart*sizeof(struct dsTouchData));
+        if (firstPart < count)
+            memcpy(&oData[firstPart], &iRing->touches[0], (count-firstPart)*sizeof(struct dsTouchData));
+
+        dsMemoryBarrier();
+        if (firstSlot->counter == firstCounter)
+            return count;
+    }
+
+    return 0;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef DSMotionTrace_H
+#define DSMotionTrace_H
+
+/*
+ * Trace file written by the kernel plugin when "ux0:data/dsmotion/trace.bin" exists at startup.
+ * Each start of the plugin appends a header followed by fixed size records, flushed CPU after CPU:
+ * records are only ordered by their timestamps, which restart with each boot (see tools/dstrace.c to get a timeline).
+ */
+
+#define DS_TRACE_MAGIC   0x52544D44 // "DMTR"
+#define DS_TRACE_VERSION 2
+
+// Kernel plugin events
+#define DS_TRACE_LOST            0x01 // Records dropped because the ring was full: count
+#define DS_TRACE_MODULE_START    0x02 // SceBt lookup result, ksceBtReadEvent hook, ksceBtHidTransfer hook
+#define DS_TRACE_BT_EVENT        0x03 // Event ID, device index (-1 if unknown), receive buffer pending
+#define DS_TRACE_HID_TRANSFER    0x04 // Device index, request length, receive buffer kept
+#define DS_TRACE_REPORT          0x05 // Device index, report ID, sample counter
+#define DS_TRACE_REPORT_REJECTED 0x06 // Device index, report ID, expected report ID
+#define DS_TRACE_VID_PID         0x07 // Vendor ID, product ID, query result
+#define DS_TRACE_CONNECT         0x08 // Device index (-1 if not kept), device type, reconnection
+#define DS_TRACE_DISCONNECT      0x09 // Device index
+#define DS_TRACE_READ_EVENT_END  0x0A // Events count, hook duration (us)
+
+// User plugin events (given with dsTrace)
+#define DS_TRACE_USER_FIRST        0x100
+#define DS_TRACE_USER_START        0x100 // sceMotionStartSampling, sceMotionGetState and sceMotionGetSensorState hooks
+#define DS_TRACE_USER_STOP         0x101 // State cache hits, state cache misses, lost sensor samples
+#define DS_TRACE_START_SAMPLING    0x102 // Result, sample counter
+#define DS_TRACE_GET_STATE         0x103 // Result, sample counter, from cache
+#define DS_TRACE_GET_SENSOR_STATE  0x104 // Result, records asked, records given
+#define DS_TRACE_TOUCH             0x105 // Touch port, buffers, touchpad states read
+#define DS_TRACE_STATE_CACHE       0x106 // State cache hits, state cache misses, lost sensor samples (every DS_TRACE_STATE_CACHE_PERIOD sceMotionGetState calls)
+
+#define DS_TRACE_STATE_CACHE_PERIOD 1024
+
+#define DS_TRACE_ARGS 3
+
+// Same size as a record, to be found between the records of the previous start
+struct dsTraceHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int timestamp; // us at the plugin start, same time base as the records following it
+    unsigned int reserved[3];
+};
+
+struct dsTraceRecord
+{
+    unsigned int sequence;  // Record number on its CPU (from 1), 0 for records added while flushing
+    unsigned int timestamp; // us, same time base as sceKernelGetSystemTimeLow
+    unsigned short event;
+    unsigned char cpu;
+    unsigned char reserved;
+    int args[DS_TRACE_ARGS];
+};
+
+#endif
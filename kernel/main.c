@@ -24,17 +24,23 @@
 #include <psp2kern/kernel/threadmgr.h>
 #include <psp2kern/kernel/sysmem.h>
 #include <psp2kern/kernel/suspend.h>
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/io/stat.h>
 #include <psp2kern/bt.h>
 #include <psp2/motion.h>
 #include <taihen.h>
 
-//#include "log.h"
 #include <string.h>
+#include <stddef.h>
 #include "../DSMotionLibrary.h"
+#include "../DSMotionRing.h"
+#include "../DSMotionCapture.h"
+#include "../DSMotionTrace.h"
 
 
 extern unsigned int ksceKernelGetSystemTimeLow();
 
+#undef abs
 #define abs(x) (((x) < 0) ? -(x) : (x))
 
 #define SONY_VID 0x054C
@@ -188,102 +194,2291 @@ struct ds4_input_report {
 
 } __attribute__((packed, aligned(32)));
 
-static int ds3_connected = 0;
-static struct ds3_input_report ds3_input;
+#define DS5_PID      0x0CE6
+#define DS5_EDGE_PID 0x0DF2
 
-static int ds4_connected = 0;
-static struct ds4_input_report ds4_input;
+// DualSense full BlueTooth report (0x31): same sensor axes and units as DS4
+struct ds5_input_report {
+	unsigned char report_id;
+	unsigned char seq_tag;
+
+	unsigned char left_x;
+	unsigned char left_y;
+	unsigned char right_x;
+	unsigned char right_y;
+
+	unsigned char l_trigger;
+	unsigned char r_trigger;
+
+	unsigned char seq_number;
+	unsigned char buttons[4];
+	unsigned char unk1[4];
+
+	signed short gyro_x;
+	signed short gyro_y;
+	signed short gyro_z;
+
+	signed short accel_x;
+	signed short accel_y;
+	signed short accel_z;
+
+	unsigned int sensor_timestamp;
+
+} __attribute__((packed, aligned(32)));
+
+/*
+ * Controller clock reconstruction: DS4 and DualSense reports carry the time when the controller sampled
+ * its sensors (DS4: 16/3 us ticks on 16 bits, DualSense: 1/3 us ticks on 32 bits). This time is extended and mapped to system time with an offset which
+ * follows the earliest arrivals (BlueTooth delays only make packets late) and slowly drifts upward
+ * to follow clock drift. Samples then keep their real spacing whatever the BlueTooth bursts.
+ */
+
+#define CLOCK_MAX_GAP 300000 // us, controller ticks wrap after 349ms
+#define CLOCK_DRIFT_SHIFT 8
+
+struct controllerClock
+{
+    int valid;
+    unsigned int lastTicks;
+    unsigned int remainder;
+    unsigned int lastArrival;
+    unsigned int controllerTime;
+    unsigned int offset;
+};
+
+static unsigned int controllerClockUpdate(struct controllerClock* ioClock, unsigned int iTicks, unsigned int iTickMask,
+                                          unsigned int iTickMul, unsigned int iTickDiv, unsigned int iArrival)
+{
+    if (!ioClock->valid || iArrival-ioClock->lastArrival > CLOCK_MAX_GAP)
+    {
+        ioClock->valid = 1;
+        ioClock->remainder = 0;
+        ioClock->controllerTime = 0;
+        ioClock->offset = iArrival;
+    }
+    else
+    {
+        unsigned int scaledTicks = ((iTicks-ioClock->lastTicks) & iTickMask) * iTickMul + ioClock->remainder;
+        ioClock->controllerTime += scaledTicks / iTickDiv;
+        ioClock->remainder = scaledTicks % iTickDiv;
+
+        int residual = (int)(iArrival - (ioClock->controllerTime + ioClock->offset));
+        if (residual < 0)
+            ioClock->offset += residual;
+        else
+            ioClock->offset += residual >> CLOCK_DRIFT_SHIFT;
+    }
+
+    ioClock->lastTicks = iTicks;
+    ioClock->lastArrival = iArrival;
+
+    return ioClock->controllerTime + ioClock->offset;
+}
+
+/*
+ * Smoothing filters updated with each sample, in Q8 fixed point.
+ * Coefficients come from the real interval between samples, so the smoothing time
+ * stays the same whatever the controller packet rate.
+ */
+
+#define FILTER_SHIFT 8
+#define FILTER_MAX_GAP 100000 // us, filter starts over after a longer gap
+#define FILTER_DERIVATIVE_TAU 159155 // us, 1Hz cutoff for one euro speed
+#define FILTER_TAU_FROM_MILLIHZ 159154943 // us.mHz, 1e9 / 2pi
+
+struct filterAxis
+{
+    int value;
+    int stage; // Critically damped: second EMA ; one euro: filtered speed (units/s)
+};
+
+struct filterState
+{
+    struct filterAxis accel[3];
+    struct filterAxis gyro[3];
+    unsigned int lastTimestamp;
+    unsigned int generation;
+};
+
+// Smoothing factor in Q16 for an EMA with time constant iTau
+static int filterAlpha(unsigned int iDelta, unsigned int iTau)
+{
+    return (int)(((unsigned long long)iDelta << 16) / (iTau + iDelta));
+}
+
+static int filterEMA(int iValue, int iTarget, int iAlpha)
+{
+    return iValue + (int)(((long long)(iTarget - iValue) * iAlpha) >> 16);
+}
+
+// Coefficients shared by all axes for one sample
+struct filterStep
+{
+    unsigned int delta;
+    int alpha;
+    int halfAlpha;
+    int speedAlpha;
+};
+
+static void filterAxisReset(const struct dsFilterParams* iParams, struct filterAxis* oAxis, int iValue)
+{
+    int target = iValue << FILTER_SHIFT;
+    oAxis->value = target;
+    oAxis->stage = (DS_FILTER_CRITICALLY_DAMPED == iParams->type) ? target : 0;
+}
+
+static void filterAxisUpdate(const struct dsFilterParams* iParams, const struct filterStep* iStep, struct filterAxis* ioAxis, int iValue)
+{
+    int target = iValue << FILTER_SHIFT;
+
+    switch (iParams->type)
+    {
+    case DS_FILTER_EMA:
+        ioAxis->value = filterEMA(ioAxis->value, target, iStep->alpha);
+        break;
+
+    case DS_FILTER_CRITICALLY_DAMPED:
+        ioAxis->value = filterEMA(ioAxis->value, target, iStep->halfAlpha);
+        ioAxis->stage = filterEMA(ioAxis->stage, ioAxis->value, iStep->halfAlpha);
+        break;
+
+    case DS_FILTER_ONE_EURO:
+    {
+        long long speed = ((long long)(target - ioAxis->value) * 1000000) / (int)iStep->delta;
+        if (speed > 0x7FFFFFFF)
+            speed = 0x7FFFFFFF;
+        else if (speed < -0x7FFFFFFF)
+            speed = -0x7FFFFFFF;
+        ioAxis->stage = filterEMA(ioAxis->stage, (int)speed, iStep->speedAlpha);
+
+        unsigned int cutoff = iParams->minCutoffMilliHz + (unsigned int)(((unsigned long long)abs(ioAxis->stage >> FILTER_SHIFT) * iParams->beta) / 1000);
+        unsigned int tau = (0 != cutoff) ? FILTER_TAU_FROM_MILLIHZ / cutoff : FILTER_MAX_GAP;
+        ioAxis->value = filterEMA(ioAxis->value, target, filterAlpha(iStep->delta, tau));
+        break;
+    }
+    }
+}
+
+static signed short filterAxisOutput(const struct dsFilterParams* iParams, const struct filterAxis* iAxis)
+{
+    int value = (DS_FILTER_CRITICALLY_DAMPED == iParams->type) ? iAxis->stage : iAxis->value;
+    return (value + (1 << (FILTER_SHIFT-1))) >> FILTER_SHIFT;
+}
+
+// Filter starts over when its settings change (new generation)
+static void filterSample(struct filterState* ioState, const struct dsFilterParams* iParams, unsigned int iGeneration,
+                         int iReset, const struct accelGyroData* iData, struct accelGyroValues* oValues)
+{
+    const struct dsFilterParams* params = iParams;
+    unsigned int delta = iData->timestamp - ioState->lastTimestamp;
+
+    if (iReset || ioState->generation != iGeneration || 0 == delta || delta > FILTER_MAX_GAP)
+    {
+        for (int i = 0 ; i < 3 ; i++)
+            filterAxisReset(params, &ioState->accel[i], iData->accel[i]);
+        for (int i = 0 ; i < 3 ; i++)
+            filterAxisReset(params, &ioState->gyro[i], iData->gyro[i]);
+        ioState->generation = iGeneration;
+    }
+    else
+    {
+        struct filterStep step;
+        step.delta = delta;
+        step.alpha = filterAlpha(delta, params->timeConstantUS);
+        step.halfAlpha = filterAlpha(delta, params->timeConstantUS/2);
+        step.speedAlpha = filterAlpha(delta, FILTER_DERIVATIVE_TAU);
+
+        for (int i = 0 ; i < 3 ; i++)
+            filterAxisUpdate(params, &step, &ioState->accel[i], iData->accel[i]);
+        for (int i = 0 ; i < 3 ; i++)
+            filterAxisUpdate(params, &step, &ioState->gyro[i], iData->gyro[i]);
+    }
+    ioState->lastTimestamp = iData->timestamp;
+
+    for (int i = 0 ; i < 3 ; i++)
+        oValues->accel[i] = filterAxisOutput(params, &ioState->accel[i]);
+    for (int i = 0 ; i < 3 ; i++)
+        oValues->gyro[i] = filterAxisOutput(params, &ioState->gyro[i]);
+}
+
+// Sensor values of a controller type (see the report descriptors)
+struct sensorScale
+{
+    unsigned short accelOneG;  // Accelerometer value of 1G
+    unsigned short gyroOneRad; // Gyroscope value of 1 rad/s, 0 if unknown
+};
+
+/*
+ * Online calibration: during still periods (steady sensors for a while) the gyroscope gives its bias,
+ * and gravity measured along an axis in both directions gives the accelerometer offset and scale of this axis.
+ * Thresholds follow the sensor scale of the controller type: types without known gyroscope scale are not calibrated.
+ * Values are remembered for each controller with its identity.
+ */
+
+#define CALIB_STILL_SAMPLES 100
+#define CALIB_GYRO_STILL_RANGE(scale) ((scale)->gyroOneRad/20)  // 0.05 rad/s
+#define CALIB_ACCEL_STILL_RANGE(scale) ((scale)->accelOneG/20) // 0.05 G
+#define CALIB_MAX_GYRO_BIAS(scale) ((scale)->gyroOneRad*2/5)    // 0.4 rad/s
+#define CALIB_AXIS_MIN(scale) ((scale)->accelOneG*4/5) // Gravity along one axis only
+#define CALIB_AXIS_MAX(scale) ((scale)->accelOneG/5)   // Gravity on other axes
+#define CALIB_SCALE_SHIFT 14
+#define CALIB_SAVE_DELTA 8
+
+struct calibration
+{
+    int gyroValid;
+    signed short gyroBias[3];
+    signed short accelPlus[3];  // Gravity measured along each axis in both directions, 0 if not measured
+    signed short accelMinus[3];
+    signed short accelOffset[3];
+    unsigned short accelScale[3]; // 0 if unknown
+};
+
+struct calibrationState
+{
+    struct calibration values;
+    signed short savedGyroBias[3];
+
+    int count;
+    int sumAccel[3];
+    int sumGyro[3];
+    signed short minAccel[3];
+    signed short maxAccel[3];
+    signed short minGyro[3];
+    signed short maxGyro[3];
+};
+
+static void calibrationReset(struct calibrationState* oState, const struct calibration* iValues)
+{
+    memset(oState, 0, sizeof(*oState));
+    if (NULL != iValues)
+        oState->values = *iValues;
+    memcpy(oState->savedGyroBias, oState->values.gyroBias, sizeof(oState->savedGyroBias));
+}
+
+static void calibrationAxis(struct calibration* ioValues, const struct sensorScale* iScale, int iAxis, int iGravity)
+{
+    signed short* measure = (iGravity > 0) ? &ioValues->accelPlus[iAxis] : &ioValues->accelMinus[iAxis];
+    *measure = (0 == *measure) ? iGravity : (*measure * 3 + iGravity) / 4;
+
+    int range = ioValues->accelPlus[iAxis] - ioValues->accelMinus[iAxis];
+    if (0 != ioValues->accelPlus[iAxis] && 0 != ioValues->accelMinus[iAxis] && range > iScale->accelOneG)
+    {
+        ioValues->accelOffset[iAxis] = (ioValues->accelPlus[iAxis] + ioValues->accelMinus[iAxis]) / 2;
+        ioValues->accelScale[iAxis] = ((2 * iScale->accelOneG) << CALIB_SCALE_SHIFT) / range;
+    }
+}
+
+// Returns 1 when calibration changed enough to be saved
+static int calibrationUpdate(struct calibrationState* ioState, const struct sensorScale* iScale, const struct accelGyroData* iRaw)
+{
+    // Still periods can't be told from slow rotations
+    if (0 == iScale->gyroOneRad)
+        return 0;
+
+    if (0 == ioState->count)
+    {
+        memset(ioState->sumAccel, 0, sizeof(ioState->sumAccel));
+        memset(ioState->sumGyro, 0, sizeof(ioState->sumGyro));
+        for (int i = 0 ; i < 3 ; i++)
+        {
+            ioState->minAccel[i] = ioState->maxAccel[i] = iRaw->accel[i];
+            ioState->minGyro[i] = ioState->maxGyro[i] = iRaw->gyro[i];
+        }
+    }
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        if (iRaw->accel[i] < ioState->minAccel[i]) ioState->minAccel[i] = iRaw->accel[i];
+        if (iRaw->accel[i] > ioState->maxAccel[i]) ioState->maxAccel[i] = iRaw->accel[i];
+        if (iRaw->gyro[i] < ioState->minGyro[i]) ioState->minGyro[i] = iRaw->gyro[i];
+        if (iRaw->gyro[i] > ioState->maxGyro[i]) ioState->maxGyro[i] = iRaw->gyro[i];
+
+        // Controller is moving: still period starts over from this sample
+        if (ioState->maxAccel[i]-ioState->minAccel[i] > CALIB_ACCEL_STILL_RANGE(iScale) || ioState->maxGyro[i]-ioState->minGyro[i] > CALIB_GYRO_STILL_RANGE(iScale))
+        {
+            ioState->count = 0;
+            return 0;
+        }
+
+        ioState->sumAccel[i] += iRaw->accel[i];
+        ioState->sumGyro[i] += iRaw->gyro[i];
+    }
+
+    if (++ioState->count < CALIB_STILL_SAMPLES)
+        return 0;
+    ioState->count = 0;
+
+    struct calibration* values = &ioState->values;
+    int toSave = 0;
+
+    int meanGyro[3];
+    int biasValid = 1;
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        meanGyro[i] = ioState->sumGyro[i] / CALIB_STILL_SAMPLES;
+        biasValid = biasValid && abs(meanGyro[i]) < CALIB_MAX_GYRO_BIAS(iScale);
+    }
+
+    if (biasValid)
+    {
+        for (int i = 0 ; i < 3 ; i++)
+        {
+            values->gyroBias[i] = values->gyroValid ? (values->gyroBias[i] * 3 + meanGyro[i]) / 4 : meanGyro[i];
+            toSave = toSave || abs(values->gyroBias[i] - ioState->savedGyroBias[i]) > CALIB_SAVE_DELTA;
+        }
+        toSave = toSave || !values->gyroValid;
+        values->gyroValid = 1;
+    }
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        int gravity = ioState->sumAccel[i] / CALIB_STILL_SAMPLES;
+        int other1 = ioState->sumAccel[(i+1)%3] / CALIB_STILL_SAMPLES;
+        int other2 = ioState->sumAccel[(i+2)%3] / CALIB_STILL_SAMPLES;
+        if (abs(gravity) > CALIB_AXIS_MIN(iScale) && abs(other1) < CALIB_AXIS_MAX(iScale) && abs(other2) < CALIB_AXIS_MAX(iScale))
+        {
+            toSave = toSave || 0 == ((gravity > 0) ? values->accelPlus[i] : values->accelMinus[i]);
+            calibrationAxis(values, iScale, i, gravity);
+        }
+    }
+
+    if (toSave)
+        memcpy(ioState->savedGyroBias, values->gyroBias, sizeof(ioState->savedGyroBias));
+    return toSave;
+}
+
+static void calibrationApply(const struct calibration* iValues, struct accelGyroData* ioData)
+{
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        // Raw values at the end of the range must not wrap around
+        if (iValues->gyroValid)
+        {
+            int gyro = ioData->gyro[i] - iValues->gyroBias[i];
+            ioData->gyro[i] = (gyro > 0x7FFF) ? 0x7FFF : ((gyro < -0x8000) ? -0x8000 : gyro);
+        }
+
+        if (0 != iValues->accelScale[i])
+        {
+            int accel = ((ioData->accel[i] - iValues->accelOffset[i]) * iValues->accelScale[i]) >> CALIB_SCALE_SHIFT;
+            ioData->accel[i] = (accel > 0x7FFF) ? 0x7FFF : ((accel < -0x8000) ? -0x8000 : accel);
+        }
+    }
+}
+
+/*
+ * Orientation: same Mahony filter as the user plugin one (proportional gain 1, integral gain 0.05)
+ * in fixed point so that it runs with each sample without FPU context.
+ * Values are Q30, angles in radians and the quaternion is renormalized by a Newton step.
+ */
+
+#define FUSION_SHIFT 30
+#define FUSION_ONE (1 << FUSION_SHIFT)
+#define FUSION_KI (FUSION_ONE / 20)
+#define FUSION_MAX_GAP 100000 // us, orientation is aligned on gravity again after a longer gap
+#define FUSION_US_TO_SECONDS 1125899907 // 2^30 / 1000000 in Q20
+#define FUSION_GYRO_HALF_ANGLE 884277884 // 2^30 / (2 * 2607.6 * 1000000) in Q32, raw gyroscope by microseconds to half angle
+
+struct fusionState
+{
+    struct dsQuaternion quat;
+    int gyroBias[3]; // rad/s
+    int ready;
+    unsigned int lastTimestamp;
+};
+
+static inline int fusionMul(int iVal1, int iVal2)
+{
+    return (int)(((long long)iVal1 * iVal2) >> FUSION_SHIFT);
+}
+
+// 2^60 / sqrt(iSquare) computed by Newton steps after reduction to [0.5, 2) in Q60
+static long long fusionInvSqrt(unsigned long long iSquare)
+{
+    if (0 == iSquare)
+        return 0;
+
+    int shift = 0;
+    while (iSquare >= (2ULL << 60))
+    {
+        iSquare >>= 2;
+        shift--;
+    }
+    while (iSquare < (1ULL << 59))
+    {
+        iSquare <<= 2;
+        shift++;
+    }
+
+    long long square = (long long)(iSquare >> FUSION_SHIFT);
+    long long res = FUSION_ONE;
+    for (int i = 0 ; i < 5 ; i++)
+    {
+        long long sqRes = (res * res) >> FUSION_SHIFT;
+        res = (res * ((3LL << (FUSION_SHIFT-1)) - ((square * sqRes) >> (FUSION_SHIFT+1)))) >> FUSION_SHIFT;
+    }
+
+    return (shift >= 0) ? (res << shift) : (res >> -shift);
+}
+
+// Unit vector in Q30 from a vector of any scale (squared norm must stay under 2^62)
+static int fusionNormalize(const long long* iVector, int iCount, int* oUnit)
+{
+    unsigned long long sqNorm = 0;
+    for (int i = 0 ; i < iCount ; i++)
+        sqNorm += iVector[i] * iVector[i];
+
+    long long invNorm = fusionInvSqrt(sqNorm);
+    if (0 == invNorm)
+        return 0;
+
+    for (int i = 0 ; i < iCount ; i++)
+        oUnit[i] = (int)((iVector[i] * invNorm) >> FUSION_SHIFT);
+    return 1;
+}
+
+// Controller values in SceMotion default axes (see the user plugin axis table)
+static void fusionAxes(const struct accelGyroData* iData, long long oAccel[3], int oGyro[3])
+{
+    oAccel[0] = -iData->accel[2];
+    oAccel[1] = iData->accel[0];
+    oAccel[2] = -iData->accel[1];
+
+    oGyro[0] = iData->gyro[0];
+    oGyro[1] = -iData->gyro[2];
+    oGyro[2] = iData->gyro[1];
+}
+
+// Shortest rotation from the resting gravity {0, -1, 0} to the measured one
+static int fusionAlign(struct dsQuaternion* oQuat, const long long iAccel[3])
+{
+    long long scaled[3] = {iAccel[0] << 15, iAccel[1] << 15, iAccel[2] << 15};
+    int accel[3];
+    if (!fusionNormalize(scaled, 3, accel))
+        return 0;
+
+    // Half angle quaternion is the normalized {1 + cos(angle), sin(angle) * axis}
+    long long quat[4] = {accel[2] >> 1, 0, -accel[0] >> 1, (FUSION_ONE - accel[1]) >> 1};
+    int unit[4];
+    if (!fusionNormalize(quat, 4, unit))
+    {
+        // Upside down: half turn around x
+        unit[0] = FUSION_ONE;
+        unit[1] = unit[2] = unit[3] = 0;
+    }
+
+    oQuat->x = unit[0];
+    oQuat->y = unit[1];
+    oQuat->z = unit[2];
+    oQuat->w = unit[3];
+    return 1;
+}
+
+static void fusionSample(struct fusionState* ioState, int iReset, const struct sensorScale* iScale, const struct accelGyroData* iData, struct dsQuaternion* oQuat)
+{
+    static const struct dsQuaternion identity = {0, 0, 0, FUSION_ONE};
+    struct dsQuaternion* q = &ioState->quat;
+
+    long long accel[3];
+    int gyro[3];
+    fusionAxes(iData, accel, gyro);
+
+    unsigned int delta = iData->timestamp - ioState->lastTimestamp;
+    ioState->lastTimestamp = iData->timestamp;
+
+    if (iReset)
+    {
+        memset(ioState->gyroBias, 0, sizeof(ioState->gyroBias));
+        ioState->ready = 0;
+    }
+
+    if (!ioState->ready || delta > FUSION_MAX_GAP)
+    {
+        ioState->ready = fusionAlign(q, accel);
+        *oQuat = ioState->ready ? *q : identity;
+        return;
+    }
+
+    // Gyroscope rotation during the sample period, as half angles
+    int half[3];
+    for (int i = 0 ; i < 3 ; i++)
+        half[i] = (int)(((long long)gyro[i] * delta * FUSION_GYRO_HALF_ANGLE) >> 32);
+
+    // Accelerometer correction is skipped when the controller is shaken (far from 1G)
+    long long accelSqNorm = accel[0]*accel[0] + accel[1]*accel[1] + accel[2]*accel[2];
+    long long sqOneG = iScale->accelOneG * iScale->accelOneG;
+    if (2 * accelSqNorm > sqOneG && 2 * accelSqNorm < 3 * sqOneG)
+    {
+        int a[3];
+        fusionNormalize(accel, 3, a);
+
+        // Expected gravity direction {0, -1, 0} in device frame
+        int v[3];
+        v[0] = -2 * (fusionMul(q->x, q->y) + fusionMul(q->w, q->z));
+        v[1] = -(fusionMul(q->w, q->w) - fusionMul(q->x, q->x) + fusionMul(q->y, q->y) - fusionMul(q->z, q->z));
+        v[2] = -2 * (fusionMul(q->y, q->z) - fusionMul(q->w, q->x));
+
+        int e[3];
+        e[0] = fusionMul(a[1], v[2]) - fusionMul(a[2], v[1]);
+        e[1] = fusionMul(a[2], v[0]) - fusionMul(a[0], v[2]);
+        e[2] = fusionMul(a[0], v[1]) - fusionMul(a[1], v[0]);
+
+        int dt = (int)(((long long)delta * FUSION_US_TO_SECONDS) >> 20);
+        for (int i = 0 ; i < 3 ; i++)
+        {
+            ioState->gyroBias[i] += fusionMul(FUSION_KI, fusionMul(e[i], dt));
+            half[i] += fusionMul(e[i] + ioState->gyroBias[i], dt >> 1);
+        }
+    }
+
+    int qw = q->w;
+    int qx = q->x;
+    int qy = q->y;
+    int qz = q->z;
+
+    qw += -fusionMul(q->x, half[0]) - fusionMul(q->y, half[1]) - fusionMul(q->z, half[2]);
+    qx +=  fusionMul(q->w, half[0]) + fusionMul(q->y, half[2]) - fusionMul(q->z, half[1]);
+    qy +=  fusionMul(q->w, half[1]) - fusionMul(q->x, half[2]) + fusionMul(q->z, half[0]);
+    qz +=  fusionMul(q->w, half[2]) + fusionMul(q->x, half[1]) - fusionMul(q->y, half[0]);
+
+    // Norm stays close to 1: one Newton step of 1/sqrt is enough
+    long long sqNorm = ((long long)qw*qw + (long long)qx*qx + (long long)qy*qy + (long long)qz*qz) >> FUSION_SHIFT;
+    long long scale = ((3LL << FUSION_SHIFT) - sqNorm) >> 1;
+    q->w = (int)((qw * scale) >> FUSION_SHIFT);
+    q->x = (int)((qx * scale) >> FUSION_SHIFT);
+    q->y = (int)((qy * scale) >> FUSION_SHIFT);
+    q->z = (int)((qz * scale) >> FUSION_SHIFT);
+
+    *oQuat = *q;
+}
+
+static void fusionMatrix(const struct dsQuaternion* iQuat, int oMatrix[9])
+{
+    int sqx = fusionMul(iQuat->x, iQuat->x);
+    int sqy = fusionMul(iQuat->y, iQuat->y);
+    int sqz = fusionMul(iQuat->z, iQuat->z);
+    int sqw = fusionMul(iQuat->w, iQuat->w);
+
+    oMatrix[0] =  sqx - sqy - sqz + sqw;
+    oMatrix[4] = -sqx + sqy - sqz + sqw;
+    oMatrix[8] = -sqx - sqy + sqz + sqw;
+
+    int tmp1 = fusionMul(iQuat->x, iQuat->y);
+    int tmp2 = fusionMul(iQuat->z, iQuat->w);
+    oMatrix[3] = 2 * (tmp1 + tmp2);
+    oMatrix[1] = 2 * (tmp1 - tmp2);
+
+    tmp1 = fusionMul(iQuat->x, iQuat->z);
+    tmp2 = fusionMul(iQuat->y, iQuat->w);
+    oMatrix[6] = 2 * (tmp1 - tmp2);
+    oMatrix[2] = 2 * (tmp1 + tmp2);
+
+    tmp1 = fusionMul(iQuat->y, iQuat->z);
+    tmp2 = fusionMul(iQuat->x, iQuat->w);
+    oMatrix[7] = 2 * (tmp1 + tmp2);
+    oMatrix[5] = 2 * (tmp1 - tmp2);
+}
+
+/*
+ * Each connected controller has its own sample ring written by the BlueTooth hook only
+ * and read by any thread without lock (see DSMotionRing.h).
+ * Rings live in a memory block which user processes can read directly: write positions
+ * are kept here and only published to the ring, the kernel never reads them back.
+ */
+struct dsDevice
+{
+    volatile int type;
+    unsigned int mac0;
+    unsigned int mac1;
+    unsigned char* recv_buff;
+
+    struct dsSharedDevice* ring;
+    unsigned int generation;
+    volatile unsigned int counter;
+    volatile unsigned int touchCounter;
+    struct accelGyroSum runningSum;
+    unsigned int lastArrival;
+
+    struct controllerClock clock;
+    struct fusionState fusion;
+    unsigned long long wideTimestamp;
+
+    struct calibrationState calibration;
+    struct deviceIdentity* identity;
+};
+
+static struct dsDevice devices[DS_MAX_DEVICES];
+
+// Incremented with each connection or reconnection, 0 is never used
+static unsigned int connectionGeneration = 0;
+
+/*
+ * Two bits per device, one for even and one for odd sample counters: the bit of the most recent counter is set
+ * and the other one cleared. Waiters wait for the bit of the counter after theirs and never clear it,
+ * so that every waiter is woken. Both bits are set on disconnection.
+ */
+static SceUID sample_evf = -1;
+
+#ifndef SCE_KERNEL_ERROR_WAIT_TIMEOUT
+#define SCE_KERNEL_ERROR_WAIT_TIMEOUT 0x80028005
+#endif
+
+#define SAMPLE_EVF_BIT(device, counter) (1 << (2*(device) + ((counter) & 1)))
+#define SAMPLE_EVF_DEVICE_BITS(device) (3 << (2*(device)))
+
+#define SHARED_MEMORY_SIZE ((sizeof(struct dsSharedMemory) + 0xFFF) & ~0xFFF)
+
+// Kernel read/write, user read only
+#define SHARED_MEMBLOCK_TYPE 0x1020D046
+
+static SceUID shared_uid = -1;
+static struct dsSharedMemory* sharedMemory = NULL;
+static struct dsSharedMemory localSharedMemory; // If the shared block can't be allocated
+
+/*
+ * Hot path statistics: counters are only incremented with atomic adds
+ * so that the hooks never wait, readers get a best effort snapshot.
+ */
+static struct dsStats stats;
+
+#define STAT_INC(field) __atomic_add_fetch(&stats.field, 1, __ATOMIC_RELAXED)
+#define STAT_ADD(field, value) __atomic_add_fetch(&stats.field, (value), __ATOMIC_RELAXED)
+
+#define INTERVAL_SHIFT 4 // Averaging of packet intervals over ~16 packets
+
+static void statsReport(unsigned char iReportId, int iAccepted)
+{
+    if (iAccepted)
+        STAT_INC(acceptedReports[iReportId >> 4]);
+    else
+        STAT_INC(rejectedReports[iReportId >> 4]);
+}
+
+static void statsArrival(struct dsDevice* iDevice, unsigned int iArrival)
+{
+    if (0 != iDevice->counter)
+    {
+        int interval = iArrival - iDevice->lastArrival;
+        int deviation = interval - (int)stats.meanInterval;
+
+        stats.meanInterval += deviation >> INTERVAL_SHIFT;
+        stats.meanJitter += ((int)abs(deviation) - (int)stats.meanJitter) >> INTERVAL_SHIFT;
+
+        if (0 == stats.minInterval || (unsigned int)interval < stats.minInterval)
+            stats.minInterval = interval;
+        if ((unsigned int)interval > stats.maxInterval)
+            stats.maxInterval = interval;
+    }
+    iDevice->lastArrival = iArrival;
+}
+
+static void statsHookLatency(unsigned int iLatency)
+{
+    int bucket = 0;
+    while (iLatency > 0 && bucket < DS_STATS_LATENCY_BUCKETS-1)
+    {
+        iLatency >>= 1;
+        bucket++;
+    }
+    STAT_INC(hookLatency[bucket]);
+}
+
+int dsGetStats(struct dsStats* oStats)
+{
+    ksceKernelMemcpyKernelToUser((uintptr_t)oStats, (const void *)&stats, sizeof(struct dsStats));
+    return 0;
+}
+
+int dsResetStats()
+{
+    memset(&stats, 0, sizeof(stats));
+    return 0;
+}
+
+static volatile int primaryDevice = -1;
+
+const struct dsSharedMemory* dsGetSharedMemory()
+{
+    return (shared_uid >= 0) ? sharedMemory : NULL;
+}
+
+static void sharedOpen()
+{
+    shared_uid = ksceKernelAllocMemBlock("dsmotion_shared", SHARED_MEMBLOCK_TYPE, SHARED_MEMORY_SIZE, NULL);
+    if (shared_uid >= 0 && (ksceKernelGetMemBlockBase(shared_uid, (void**)&sharedMemory) < 0 || ksceKernelMapBlockUserVisible(shared_uid) < 0))
+    {
+        ksceKernelFreeMemBlock(shared_uid);
+        shared_uid = -1;
+    }
+
+    if (shared_uid < 0)
+        sharedMemory = &localSharedMemory;
+
+    memset(sharedMemory, 0, sizeof(struct dsSharedMemory));
+    sharedMemory->version = DS_SHARED_VERSION;
+    sharedMemory->size = sizeof(struct dsSharedMemory);
+    sharedMemory->historySize = DS_HISTORY_SIZE;
+    sharedMemory->touchHistorySize = DS_TOUCH_HISTORY_SIZE;
+    sharedMemory->primaryDevice = -1;
+
+    memset(devices, 0, sizeof(devices));
+    for (int i = 0 ; i < DS_MAX_DEVICES ; i++)
+        devices[i].ring = &sharedMemory->devices[i];
+}
+
+static void sharedClose()
+{
+    if (shared_uid >= 0)
+    {
+        ksceKernelFreeMemBlock(shared_uid);
+        shared_uid = -1;
+    }
+}
+static int lastFoundDevice = 0;
+
+static struct dsDevice* findDevice(unsigned int iMac0, unsigned int iMac1)
+{
+    // Consecutive events often come from the same controller
+    struct dsDevice* device = &devices[lastFoundDevice];
+    if (DS_DEVICE_NONE != device->type && device->mac0 == iMac0 && device->mac1 == iMac1)
+        return device;
+
+    for (int i = 0 ; i < DS_MAX_DEVICES ; i++)
+    {
+        device = &devices[i];
+        if (DS_DEVICE_NONE != device->type && device->mac0 == iMac0 && device->mac1 == iMac1)
+        {
+            lastFoundDevice = i;
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+// Returns NULL if the requested controller is not connected
+static struct dsDevice* getDevice(unsigned int iDevice)
+{
+    if (DS_PRIMARY_DEVICE == iDevice)
+        iDevice = primaryDevice;
+
+    if (iDevice >= DS_MAX_DEVICES || DS_DEVICE_NONE == devices[iDevice].type)
+        return NULL;
+
+    return &devices[iDevice];
+}
+
+static void updatePrimaryDevice()
+{
+    if (primaryDevice >= 0 && DS_DEVICE_NONE != devices[primaryDevice].type)
+        return;
+
+    int newPrimary = -1;
+    for (int i = 0 ; i < DS_MAX_DEVICES && newPrimary < 0 ; i++)
+    {
+        if (DS_DEVICE_NONE != devices[i].type)
+            newPrimary = i;
+    }
+    primaryDevice = newPrimary;
+    sharedMemory->primaryDevice = newPrimary;
+}
+
+/*
+ * Filters of the processes (see dsSetFilter): each slot keeps its state for every device.
+ * Slots of ended processes are not released, the least recently set one is reused instead.
+ */
+
+#define FILTER_SETTING -1
+
+struct filterSlot
+{
+    unsigned int lastSet;
+    struct filterState states[DS_MAX_DEVICES];
+};
+
+static struct filterSlot filterSlots[DS_MAX_FILTERS];
+static unsigned int filterUse = 0;
+static unsigned int filterGeneration = 0;
+
+static void filterUpdate(struct dsDevice* iDevice, unsigned int iCounter, const struct accelGyroData* iData)
+{
+    int index = iDevice-devices;
+
+    for (int i = 0 ; i < DS_MAX_FILTERS ; i++)
+    {
+        struct dsSharedFilter* filter = &sharedMemory->filters[i];
+        int pid = filter->pid;
+        if (pid <= 0 || DS_FILTER_BOX == filter->params.type)
+            continue;
+
+        // Settings copy is valid if the slot wasn't set meanwhile
+        struct dsFilterParams params = filter->params;
+        unsigned int generation = filter->generation;
+        dsMemoryBarrier();
+        if (filter->pid != pid || filter->generation != generation)
+            continue;
+
+        struct accelGyroValues values;
+        filterSample(&filterSlots[i].states[index], &params, generation, 1 == iCounter, iData, &values);
+
+        volatile struct dsFilterOutput* output = &filter->outputs[index];
+        output->counter = 0;
+        dsMemoryBarrier();
+
+        output->generation = generation;
+        memcpy((void *)&output->values, &values, sizeof(values));
+        dsMemoryBarrier();
+
+        output->counter = iCounter;
+    }
+}
+
+static void writeSample(struct dsDevice* iDevice, const struct sensorScale* iScale, const struct accelGyroData* iData)
+{
+    struct dsSharedDevice* ring = iDevice->ring;
+    unsigned int counter = iDevice->counter+1;
+    volatile struct accelGyroData* slot = &ring->data[counter & DS_HISTORY_MASK];
+
+    if (1 == counter)
+    {
+        memset(&iDevice->runningSum, 0, sizeof(iDevice->runningSum));
+        iDevice->wideTimestamp = ksceKernelGetSystemTimeWide();
+    }
+
+    // 32 bits timestamps are extended from the previous sample time: they may go slightly backward
+    iDevice->wideTimestamp += (int)(iData->timestamp - (unsigned int)iDevice->wideTimestamp);
+
+    struct accelGyroSum* sum = &ring->sums[counter & DS_HISTORY_MASK];
+
+    struct dsQuaternion orientation;
+    fusionSample(&iDevice->fusion, 1 == counter, iScale, iData, &orientation);
+
+    slot->counter = 0;
+    dsMemoryBarrier();
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        slot->accel[i] = iData->accel[i];
+        slot->gyro[i] = iData->gyro[i];
+
+        sum->accel[i] = (iDevice->runningSum.accel[i] += iData->accel[i]);
+        sum->gyro[i] = (iDevice->runningSum.gyro[i] += iData->gyro[i]);
+    }
+    slot->timestamp = iData->timestamp;
+    ring->timestamps[counter & DS_HISTORY_MASK] = iDevice->wideTimestamp;
+    ring->orientations[counter & DS_HISTORY_MASK] = orientation;
+    dsMemoryBarrier();
+
+    slot->counter = counter;
+    dsMemoryBarrier();
+
+    iDevice->counter = counter;
+    ring->counter = counter;
+
+    filterUpdate(iDevice, counter, iData);
+
+    if (sample_evf >= 0)
+    {
+        int index = iDevice-devices;
+        ksceKernelClearEventFlag(sample_evf, ~SAMPLE_EVF_BIT(index, counter+1));
+        ksceKernelSetEventFlag(sample_evf, SAMPLE_EVF_BIT(index, counter));
+    }
+}
+
+unsigned int dsGetCurrentTimestamp()
+{
+    return ksceKernelGetSystemTimeLow();
+}
+
+unsigned int dsGetConnectedDevices()
+{
+    unsigned int mask = 0;
+    for (int i = 0 ; i < DS_MAX_DEVICES ; i++)
+    {
+        if (DS_DEVICE_NONE != devices[i].type)
+            mask |= (1 << i);
+    }
+    return mask;
+}
+
+int dsGetDeviceType(unsigned int iDevice)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    return (NULL != device) ? device->type : DS_DEVICE_NONE;
+}
+
+unsigned int dsGetDeviceCounter(unsigned int iDevice)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    return (NULL != device) ? device->counter : 0;
+}
+
+unsigned int dsGetDeviceGeneration(unsigned int iDevice)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    return (NULL != device) ? device->generation : 0;
+}
+
+unsigned int dsGetCurrentCounter()
+{
+    return dsGetDeviceCounter(DS_PRIMARY_DEVICE);
+}
+
+static int giveWaitedCounter(unsigned int iCounter, unsigned int* oCounter)
+{
+    if (NULL != oCounter)
+        ksceKernelMemcpyKernelToUser((uintptr_t)oCounter, &iCounter, sizeof(iCounter));
+    return 1;
+}
+
+int dsWaitForSample(unsigned int iDevice, unsigned int iLastCounter, unsigned int iTimeoutUS, unsigned int* oCounter)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device || sample_evf < 0)
+        return -1;
+
+    // Bit of the next sample is cleared once the current counter is published: it can't be set by an older sample
+    unsigned int bit = SAMPLE_EVF_BIT(device-devices, iLastCounter+1);
+    unsigned int generation = device->generation;
+    SceUInt timeout = iTimeoutUS;
+
+    for (;;)
+    {
+        if (DS_DEVICE_NONE == device->type || device->generation != generation)
+            return -1;
+
+        unsigned int counter = device->counter;
+        if (counter != iLastCounter)
+            return giveWaitedCounter(counter, oCounter);
+
+        int ret = ksceKernelWaitEventFlag(sample_evf, bit, SCE_EVENT_WAITOR, NULL, (DS_WAIT_INFINITE != iTimeoutUS) ? &timeout : NULL);
+        if (SCE_KERNEL_ERROR_WAIT_TIMEOUT == (unsigned int)ret)
+        {
+            counter = device->counter;
+            return (counter != iLastCounter) ? giveWaitedCounter(counter, oCounter) : 0;
+        }
+        if (ret < 0)
+            return -1;
+    }
+}
+
+unsigned int dsGetDeviceSampledAccelGyro(unsigned int iDevice, unsigned int iSamplingTimeMS, signed short oAccel[3], signed short oGyro[3])
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return 0;
+
+    signed short accel[3];
+    signed short gyro[3];
+    unsigned int lastCounter;
+
+    int nbSamples = dsReadWindowAverage(device->ring, 1000 * iSamplingTimeMS, accel, gyro, &lastCounter);
+    if (nbSamples <= 0)
+        return 0;
+
+    ksceKernelMemcpyKernelToUser((uintptr_t)oAccel, (const void *)accel, 3*sizeof(signed short));
+    ksceKernelMemcpyKernelToUser((uintptr_t)oGyro, (const void *)gyro, 3*sizeof(signed short));
+
+    return nbSamples;
+}
+
+int dsSetFilter(const struct dsFilterParams* iParams)
+{
+    struct dsFilterParams params;
+    if (NULL == iParams || ksceKernelMemcpyUserToKernel(&params, (uintptr_t)iParams, sizeof(params)) < 0)
+        return -1;
+
+    if (params.type < DS_FILTER_BOX || params.type > DS_FILTER_ONE_EURO || params.timeConstantUS > 1000000)
+        return -1;
+
+    SceUID pid = ksceKernelGetProcessId();
+    unsigned int use = __atomic_add_fetch(&filterUse, 1, __ATOMIC_RELAXED);
+
+    // Slot of the process, else a free one, else the least recently set one: only one caller can claim it
+    int index;
+    int expectedPid;
+    int setting;
+    do
+    {
+        index = -1;
+        expectedPid = 0;
+        setting = 0;
+        for (int i = 0 ; i < DS_MAX_FILTERS ; i++)
+        {
+            int slotPid = sharedMemory->filters[i].pid;
+            if (pid == slotPid)
+            {
+                index = i;
+                expectedPid = slotPid;
+                break;
+            }
+
+            // Being set, maybe by another thread of this process
+            if (FILTER_SETTING == slotPid)
+            {
+                setting = 1;
+                continue;
+            }
+
+            if (index < 0 || (0 != expectedPid && (0 == slotPid || (int)(filterSlots[i].lastSet - filterSlots[index].lastSet) < 0)))
+            {
+                index = i;
+                expectedPid = slotPid;
+            }
+        }
+    }
+    while (index < 0 || (setting && pid != expectedPid)
+           || !__atomic_compare_exchange_n(&sharedMemory->filters[index].pid, &expectedPid, FILTER_SETTING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    // Recursive filters start over from the next sample
+    struct dsSharedFilter* filter = &sharedMemory->filters[index];
+    unsigned int generation = __atomic_add_fetch(&filterGeneration, 1, __ATOMIC_RELAXED);
+    filter->params = params;
+    filter->generation = (0 != generation) ? generation : __atomic_add_fetch(&filterGeneration, 1, __ATOMIC_RELAXED);
+    filterSlots[index].lastSet = use;
+    dsMemoryBarrier();
+
+    filter->pid = pid;
+    return 0;
+}
+
+unsigned int dsGetDeviceFilteredAccelGyro(unsigned int iDevice, signed short oAccel[3], signed short oGyro[3])
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return 0;
+
+    signed short accel[3];
+    signed short gyro[3];
+    unsigned int lastCounter;
+
+    if (dsReadFiltered(sharedMemory, ksceKernelGetProcessId(), device-devices, accel, gyro, &lastCounter) <= 0)
+        return 0;
+
+    ksceKernelMemcpyKernelToUser((uintptr_t)oAccel, (const void *)accel, 3*sizeof(signed short));
+    ksceKernelMemcpyKernelToUser((uintptr_t)oGyro, (const void *)gyro, 3*sizeof(signed short));
+
+    return lastCounter;
+}
+
+unsigned int dsGetFilteredAccelGyro(signed short oAccel[3], signed short oGyro[3])
+{
+    return dsGetDeviceFilteredAccelGyro(DS_PRIMARY_DEVICE, oAccel, oGyro);
+}
+
+int dsGetDeviceTouchHistory(unsigned int iDevice, unsigned int iCount, struct dsTouchData* oData)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return -1;
+
+    struct dsSharedDevice* ring = device->ring;
+
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = device->touchCounter;
+        unsigned int count = (lastCounter < DS_TOUCH_HISTORY_SIZE) ? lastCounter : DS_TOUCH_HISTORY_SIZE;
+        if (count > iCount)
+            count = iCount;
+        if (0 == count)
+            return 0;
+
+        // Same as dsReadTouchHistory but straight to the user buffer
+        unsigned int firstCounter = lastCounter-count+1;
+        const volatile struct dsTouchData* firstSlot = &ring->touches[firstCounter & DS_TOUCH_HISTORY_MASK];
+        if (firstSlot->counter != firstCounter)
+            continue;
+        dsMemoryBarrier();
+
+        unsigned int firstIndex = firstCounter & DS_TOUCH_HISTORY_MASK;
+        unsigned int firstPart = (firstIndex+count <= DS_TOUCH_HISTORY_SIZE) ? count : DS_TOUCH_HISTORY_SIZE-firstIndex;
+        ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&ring->touches[firstIndex], firstPart*sizeof(struct dsTouchData));
+        if (firstPart < count)
+            ksceKernelMemcpyKernelToUser((uintptr_t)&oData[firstPart], (const void *)&ring->touches[0], (count-firstPart)*sizeof(struct dsTouchData));
+
+        dsMemoryBarrier();
+        if (firstSlot->counter == firstCounter)
+            return count;
+    }
+
+    return 0;
+}
+
+int dsGetTouchHistory(unsigned int iCount, struct dsTouchData* oData)
+{
+    return dsGetDeviceTouchHistory(DS_PRIMARY_DEVICE, iCount, oData);
+}
+
+unsigned int dsGetDeviceOrientation(unsigned int iDevice, struct dsOrientation* oOrientation)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return 0;
+
+    struct dsOrientation orientation;
+    unsigned int lastCounter;
+    if (dsReadOrientation(device->ring, &orientation.quat, &lastCounter) <= 0)
+        return 0;
+
+    fusionMatrix(&orientation.quat, orientation.matrix);
+    ksceKernelMemcpyKernelToUser((uintptr_t)oOrientation, (const void *)&orientation, sizeof(orientation));
+
+    return lastCounter;
+}
+
+unsigned int dsGetOrientation(struct dsOrientation* oOrientation)
+{
+    return dsGetDeviceOrientation(DS_PRIMARY_DEVICE, oOrientation);
+}
+
+unsigned int dsGetSampledAccelGyro(unsigned int iSamplingTimeMS, signed short oAccel[3], signed short oGyro[3])
+{
+    return dsGetDeviceSampledAccelGyro(DS_PRIMARY_DEVICE, iSamplingTimeMS, oAccel, oGyro);
+}
+
+int dsGetInstantAccelGyro(unsigned int iIndex, struct accelGyroData* oData)
+{
+    struct dsDevice* device = getDevice(DS_PRIMARY_DEVICE);
+    if (NULL == device)
+        return -1;
+
+    struct accelGyroData data;
+    iIndex %= DS_HISTORY_SIZE;
+
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = device->counter;
+        if (lastCounter <= iIndex)
+            break;
+
+        if (dsReadSample(device->ring, lastCounter-iIndex, &data))
+        {
+            ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&data, sizeof(struct accelGyroData));
+            return 0;
+        }
+    }
+
+    memset(&data, 0, sizeof(data));
+    ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&data, sizeof(struct accelGyroData));
+
+    return 0;
+}
+
+// Same as dsCopySamples but straight to the user buffer
+static int copySamplesToUser(struct dsSharedDevice* iRing, unsigned int iFirstCounter, unsigned int iCount, struct accelGyroData* oData)
+{
+    const volatile struct accelGyroData* firstSlot = dsGetSampleSlot(iRing, iFirstCounter);
+    if (firstSlot->counter != iFirstCounter)
+        return 0;
+    dsMemoryBarrier();
+
+    unsigned int firstIndex = iFirstCounter & DS_HISTORY_MASK;
+    if (firstIndex+iCount <= DS_HISTORY_SIZE)
+    {
+        ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&iRing->data[firstIndex], iCount*sizeof(struct accelGyroData));
+    }
+    else
+    {
+        unsigned int firstPart = DS_HISTORY_SIZE-firstIndex;
+        ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&iRing->data[firstIndex], firstPart*sizeof(struct accelGyroData));
+        ksceKernelMemcpyKernelToUser((uintptr_t)&oData[firstPart], (const void *)&iRing->data[0], (iCount-firstPart)*sizeof(struct accelGyroData));
+    }
+
+    // Slots are overwritten from the oldest one: if it is intact, the whole copy is intact
+    dsMemoryBarrier();
+    return firstSlot->counter == iFirstCounter;
+}
+
+int dsGetDeviceAccelGyroHistory(unsigned int iDevice, unsigned int iStart, unsigned int iCount, struct accelGyroData* oData)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return -1;
+
+    struct dsSharedDevice* ring = device->ring;
+
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int lastCounter = device->counter;
+
+        unsigned int available = lastCounter;
+        if (available > DS_HISTORY_SIZE)
+            available = DS_HISTORY_SIZE;
+
+        if (iStart >= available)
+            return 0;
+
+        unsigned int count = iCount;
+        if (count > available-iStart)
+            count = available-iStart;
+
+        if (0 == count)
+            return 0;
+
+        // Records are given from the oldest to the most recent one
+        if (copySamplesToUser(ring, lastCounter-iStart-count+1, count, oData))
+            return count;
+    }
+
+    return 0;
+}
+
+int dsGetDeviceAccelGyroRange(unsigned int iDevice, const struct dsTimeRange* iRange, unsigned int iMaxCount, struct accelGyroData* oData)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return -1;
+
+    struct dsTimeRange range;
+    if (NULL == iRange || ksceKernelMemcpyUserToKernel(&range, (uintptr_t)iRange, sizeof(range)) < 0)
+        return -1;
+
+    struct dsSharedDevice* ring = device->ring;
+
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int firstCounter;
+        unsigned int count = dsFindRange(ring, &range, iMaxCount, device->counter, &firstCounter);
+        if (0 == count)
+            return 0;
+
+        if (copySamplesToUser(ring, firstCounter, count, oData))
+            return count;
+    }
+
+    return 0;
+}
+
+#define RESAMPLE_CHUNK 16
+
+/*
+ * Linear interpolation of the samples on a regular time grid ending at the most recent multiple of the period.
+ * Records are given from the oldest to the most recent one, timestamps are grid times
+ * and counters are grid times divided by the period.
+ */
+int dsGetDeviceResampledAccelGyro(unsigned int iDevice, unsigned int iPeriodUS, unsigned int iCount, struct accelGyroData* oData)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return -1;
+
+    if (0 == iPeriodUS || 0 == iCount)
+        return 0;
+
+    struct dsSharedDevice* ring = device->ring;
+    struct accelGyroData prev, next;
+    unsigned int lastCounter = dsReadLastSample(ring, &next);
+    if (0 == lastCounter)
+        return 0;
+
+    // Sample times are handled as ages relative to the most recent sample to avoid wrapping issues
+    unsigned int lastTime = next.timestamp;
+    unsigned int lastGridAge = lastTime % iPeriodUS;
+    unsigned int firstGridAge = lastGridAge + (iCount-1)*iPeriodUS;
+
+    // Binary search of the first sample younger than the first grid time
+    unsigned int minCounter = dsGetOldestCounter(lastCounter);
+    unsigned int counter = lastCounter+1;
+    unsigned int low = minCounter;
+    while (low < counter)
+    {
+        unsigned int mid = low + (counter-low)/2;
+
+        unsigned int timestamp;
+        if (dsReadSampleTimestamp(ring, mid, &timestamp) && lastTime-timestamp < firstGridAge)
+            counter = mid;
+        else
+            low = mid+1;
+    }
+
+    int havePrev = (counter > minCounter && dsReadSample(ring, counter-1, &prev));
+    if (counter <= lastCounter && !dsReadSample(ring, counter, &next))
+        return 0;
+
+    struct accelGyroData chunk[RESAMPLE_CHUNK];
+    unsigned int nbChunk = 0;
+    unsigned int nbRecords = 0;
+
+    for (unsigned int i = 0 ; i < iCount ; i++)
+    {
+        unsigned int gridAge = firstGridAge - i*iPeriodUS;
+
+        while (counter <= lastCounter && lastTime-next.timestamp >= gridAge)
+        {
+            prev = next;
+            havePrev = 1;
+            if (++counter <= lastCounter && !dsReadSample(ring, counter, &next))
+                return nbRecords;
+        }
+
+        // Nothing before this grid time anymore
+        if (!havePrev || lastTime-prev.timestamp < gridAge)
+            continue;
+
+        struct accelGyroData* record = &chunk[nbChunk++];
+        if (counter <= lastCounter)
+        {
+            unsigned int prevAge = lastTime-prev.timestamp;
+            int weight = ((prevAge-gridAge) << 8) / (prevAge-(lastTime-next.timestamp));
+            for (int j = 0 ; j < 3 ; j++)
+            {
+                record->accel[j] = prev.accel[j] + (((next.accel[j]-prev.accel[j]) * weight) >> 8);
+                record->gyro[j] = prev.gyro[j] + (((next.gyro[j]-prev.gyro[j]) * weight) >> 8);
+            }
+        }
+        else
+        {
+            memcpy(record, &prev, sizeof(struct accelGyroData));
+        }
+        record->timestamp = lastTime-gridAge;
+        record->counter = record->timestamp / iPeriodUS;
+
+        if (RESAMPLE_CHUNK == nbChunk)
+        {
+            ksceKernelMemcpyKernelToUser((uintptr_t)&oData[nbRecords], (const void *)chunk, nbChunk*sizeof(struct accelGyroData));
+            nbRecords += nbChunk;
+            nbChunk = 0;
+        }
+    }
+
+    if (nbChunk > 0)
+    {
+        ksceKernelMemcpyKernelToUser((uintptr_t)&oData[nbRecords], (const void *)chunk, nbChunk*sizeof(struct accelGyroData));
+        nbRecords += nbChunk;
+    }
+
+    return nbRecords;
+}
+
+int dsGetAccelGyroHistory(unsigned int iStart, unsigned int iCount, struct accelGyroData* oData)
+{
+    return dsGetDeviceAccelGyroHistory(DS_PRIMARY_DEVICE, iStart, iCount, oData);
+}
+
+int dsGetAccelGyroRange(const struct dsTimeRange* iRange, unsigned int iMaxCount, struct accelGyroData* oData)
+{
+    return dsGetDeviceAccelGyroRange(DS_PRIMARY_DEVICE, iRange, iMaxCount, oData);
+}
+
+/*
+ * Read cursors: each process gets the samples it hasn't read yet, whatever the other readers.
+ * Cursors of ended processes are not released, the least recently used one is reused instead.
+ * A cursor is claimed by swapping its pid for CURSOR_CLAIMING, so that two threads can't take the same one.
+ * Positions keep the connection generation with the counter: samples of two connections are never mixed.
+ */
+
+#define MAX_CURSORS 8
+#define CURSOR_NEW 0xFFFFFFFFFFFFFFFFULL
+#define CURSOR_CLAIMING -1
+#define CURSOR_POSITION(generation, counter) (((unsigned long long)(generation) << 32) | (counter))
+
+struct readCursor
+{
+    volatile SceUID pid;
+    volatile unsigned int lastUse;
+    volatile unsigned long long position[DS_MAX_DEVICES]; // Connection generation and last counter read
+};
+
+static struct readCursor cursors[MAX_CURSORS];
+static unsigned int cursorUse = 0;
+
+static struct readCursor* getCursor(SceUID iPid)
+{
+    unsigned int use = __atomic_add_fetch(&cursorUse, 1, __ATOMIC_RELAXED);
+
+    for (;;)
+    {
+        struct readCursor* reused = NULL;
+        SceUID reusedPid = 0;
+        int claiming = 0;
+
+        for (int i = 0 ; i < MAX_CURSORS ; i++)
+        {
+            struct readCursor* cursor = &cursors[i];
+            SceUID pid = cursor->pid;
+            if (iPid == pid)
+            {
+                cursor->lastUse = use;
+                return cursor;
+            }
+
+            // Being claimed, maybe by another thread of this process
+            if (CURSOR_CLAIMING == pid)
+            {
+                claiming = 1;
+                continue;
+            }
+
+            // Free cursor first, else the least recently used one
+            if (NULL == reused || (0 != reusedPid && (0 == pid || (int)(cursor->lastUse - reused->lastUse) < 0)))
+            {
+                reused = cursor;
+                reusedPid = pid;
+            }
+        }
+
+        if (claiming || NULL == reused || !__atomic_compare_exchange_n(&reused->pid, &reusedPid, CURSOR_CLAIMING, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        for (int i = 0 ; i < DS_MAX_DEVICES ; i++)
+            reused->position[i] = CURSOR_NEW;
+        reused->lastUse = use;
+        dsMemoryBarrier();
+
+        reused->pid = iPid;
+        return reused;
+    }
+}
+
+int dsGetDeviceNewAccelGyro(unsigned int iDevice, unsigned int iMaxCount, struct accelGyroData* oData, unsigned int* oLost)
+{
+    struct dsDevice* device = getDevice(iDevice);
+    if (NULL == device)
+        return -1;
+
+    struct readCursor* cursor = getCursor(ksceKernelGetProcessId());
+    volatile unsigned long long* cursorPosition = &cursor->position[device-devices];
+    struct dsSharedDevice* ring = device->ring;
+
+    for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+    {
+        unsigned int generation = device->generation;
+        dsMemoryBarrier();
+        unsigned int lastCounter = device->counter;
+        unsigned long long position = __atomic_load_n(cursorPosition, __ATOMIC_RELAXED);
+
+        unsigned int firstCounter;
+        if (CURSOR_NEW == position)
+            firstCounter = (lastCounter > iMaxCount) ? lastCounter-iMaxCount+1 : 1; // Most recent samples only for a new reader
+        else if ((unsigned int)(position >> 32) != generation)
+            firstCounter = 1; // Controller reconnection
+        else
+            firstCounter = (unsigned int)position+1;
+
+        // Samples already overwritten are lost
+        unsigned int lost = 0;
+        unsigned int oldestCounter = dsGetOldestCounter(lastCounter);
+        if (firstCounter < oldestCounter)
+        {
+            lost = oldestCounter-firstCounter;
+            firstCounter = oldestCounter;
+        }
+
+        unsigned int count = (lastCounter >= firstCounter) ? lastCounter-firstCounter+1 : 0;
+        if (count > iMaxCount)
+            count = iMaxCount;
+
+        if (count > 0 && !copySamplesToUser(ring, firstCounter, count, oData))
+            continue;
+
+        // Controller reconnected during the copy
+        dsMemoryBarrier();
+        if (device->generation != generation)
+            continue;
+
+        // Another thread of the process may have read the same samples meanwhile
+        unsigned int newCounter = (count > 0) ? firstCounter+count-1 : lastCounter;
+        if (!__atomic_compare_exchange_n(cursorPosition, &position, CURSOR_POSITION(generation, newCounter), 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            continue;
+
+        // Samples overwritten before a reader following the device got them
+        if (CURSOR_NEW != position && lost > 0)
+            STAT_ADD(unreadOverwrites, lost);
+
+        if (NULL != oLost)
+            ksceKernelMemcpyKernelToUser((uintptr_t)oLost, &lost, sizeof(lost));
+
+        return count;
+    }
+
+    return 0;
+}
+
+int dsGetNewAccelGyro(unsigned int iMaxCount, struct accelGyroData* oData, unsigned int* oLost)
+{
+    return dsGetDeviceNewAccelGyro(DS_PRIMARY_DEVICE, iMaxCount, oData, oLost);
+}
+
+/*
+ * Report decoding: each controller type is described by a static descriptor giving where
+ * its sensor fields are and how they map to DS4 axes and units.
+ * Each axis value is (sign * (raw + bias)) / divisor, raw being a signed 16 bits field.
+ */
+
+#define REPORT_FIELD_NONE 0xFF
+
+struct reportAxis
+{
+    unsigned char offset;
+    unsigned char bigEndian;
+    signed char sign;
+    signed short bias;
+    signed short divisor;
+};
+
+struct reportDescriptor
+{
+    int type;
+    unsigned char reportId;
+    unsigned char size;
+    unsigned short pid[2];
+    struct reportAxis accel[3];
+    struct reportAxis gyro[3];
+    unsigned char timestampOffset; // Controller clock, REPORT_FIELD_NONE if missing
+    unsigned char timestampBytes;  // 2 or 4
+    unsigned char tickMul;         // Tick duration is tickMul/tickDiv us
+    unsigned char tickDiv;
+    struct sensorScale scale;
+};
+
+#define REPORT_AXIS(report, field, sign, bias, divisor) {offsetof(struct report, field), 0, (sign), (bias), (divisor)}
+#define REPORT_AXIS_NONE {REPORT_FIELD_NONE, 0, 1, 0, 1}
+
+static const struct reportDescriptor ds4Descriptor =
+{
+    DS_DEVICE_DS4, 0x11, sizeof(struct ds4_input_report), {DS4_PID, DS4_2_PID},
+    // Data from gyroscope and accelerometer seem inverted on DS4
+    {REPORT_AXIS(ds4_input_report, gyro_x, 1, 0, 1), REPORT_AXIS(ds4_input_report, gyro_y, 1, 0, 1), REPORT_AXIS(ds4_input_report, gyro_z, 1, 0, 1)},
+    {REPORT_AXIS(ds4_input_report, accel_x, 1, 0, 1), REPORT_AXIS(ds4_input_report, accel_y, 1, 0, 1), REPORT_AXIS(ds4_input_report, accel_z, 1, 0, 1)},
+    offsetof(struct ds4_input_report, cnt2), 2, 16, 3,
+    {DS_ACCEL_ONE_G, 2608} // 2607.6 = 0x2000 / PI
+};
+
+static const struct reportDescriptor ds5Descriptor =
+{
+    DS_DEVICE_DUALSENSE, 0x31, sizeof(struct ds5_input_report), {DS5_PID, DS5_EDGE_PID},
+    // Same order as DS4 samples
+    {REPORT_AXIS(ds5_input_report, accel_z, 1, 0, 1), REPORT_AXIS(ds5_input_report, accel_y, 1, 0, 1), REPORT_AXIS(ds5_input_report, accel_x, 1, 0, 1)},
+    {REPORT_AXIS(ds5_input_report, gyro_x, 1, 0, 1), REPORT_AXIS(ds5_input_report, gyro_y, 1, 0, 1), REPORT_AXIS(ds5_input_report, gyro_z, 1, 0, 1)},
+    offsetof(struct ds5_input_report, sensor_timestamp), 4, 1, 3,
+    {DS_ACCEL_ONE_G, 2608}
+};
+
+static const struct reportDescriptor ds3Descriptor =
+{
+    DS_DEVICE_DS3, 0x01, sizeof(struct ds3_input_report), {DS3_PID, DS3_PID},
+    // DS3 matching with DS4
+    {REPORT_AXIS(ds3_input_report, accel_y, -1, 0, 4), REPORT_AXIS(ds3_input_report, accel_z, -1, 0, 4), REPORT_AXIS(ds3_input_report, accel_x, 1, 0, 4)},
+    {REPORT_AXIS_NONE, REPORT_AXIS(ds3_input_report, gyro_z, 1, 0x15FF, 10), REPORT_AXIS_NONE},
+    REPORT_FIELD_NONE, 0, 1, 1,
+    {DS_ACCEL_ONE_G_DS3, 0}
+};
+
+static const struct reportDescriptor* const reportDescriptors[] = {&ds4Descriptor, &ds5Descriptor, &ds3Descriptor};
+
+#define NB_REPORT_DESCRIPTORS (sizeof(reportDescriptors)/sizeof(reportDescriptors[0]))
+
+static const struct reportDescriptor* getReportDescriptor(int iType)
+{
+    for (int i = 0 ; i < NB_REPORT_DESCRIPTORS ; i++)
+    {
+        if (reportDescriptors[i]->type == iType)
+            return reportDescriptors[i];
+    }
+    return NULL;
+}
+
+static int getDeviceTypeFromVidPid(const unsigned short vid_pid[2])
+{
+    if (vid_pid[0] != SONY_VID)
+        return DS_DEVICE_NONE;
+
+    for (int i = 0 ; i < NB_REPORT_DESCRIPTORS ; i++)
+    {
+        const struct reportDescriptor* desc = reportDescriptors[i];
+        if (vid_pid[1] == desc->pid[0] || vid_pid[1] == desc->pid[1])
+            return desc->type;
+    }
+    return DS_DEVICE_NONE;
+}
+
+static unsigned int getReportSize(int iType)
+{
+    const struct reportDescriptor* desc = getReportDescriptor(iType);
+    return (NULL != desc) ? desc->size : 0;
+}
 
-static unsigned char* recv_buff = NULL;
-static unsigned int ds_mac0 = 0;
-static unsigned int ds_mac1 = 0;
+static unsigned char getReportId(int iType)
+{
+    const struct reportDescriptor* desc = getReportDescriptor(iType);
+    return (NULL != desc) ? desc->reportId : 0;
+}
 
-#define NB_DATA 64
+// Reads straight from the report buffer: it has no alignment guarantee
+static inline __attribute__((always_inline)) int readReportField(const unsigned char* iReport, unsigned char iOffset, int iBigEndian)
+{
+    return iBigEndian ? (signed short)((iReport[iOffset] << 8) | iReport[iOffset+1])
+                      : (signed short)(iReport[iOffset] | (iReport[iOffset+1] << 8));
+}
 
-static struct accelGyroData previousData[NB_DATA];
-static int currentData = NB_DATA-1;
-static int globalCounter = 0;
+static inline __attribute__((always_inline)) signed short decodeAxis(const unsigned char* iReport, const struct reportAxis* iAxis)
+{
+    if (REPORT_FIELD_NONE == iAxis->offset)
+        return 0;
 
-unsigned int dsGetCurrentTimestamp()
+    int value = readReportField(iReport, iAxis->offset, iAxis->bigEndian) + iAxis->bias;
+    if (iAxis->sign < 0)
+        value = -value;
+    return (1 == iAxis->divisor) ? value : value / iAxis->divisor;
+}
+
+/*
+ * Always inlined with a constant descriptor: each controller type gets its own
+ * extraction routine where offsets, shifts and divisions are known at compile time.
+ */
+static inline __attribute__((always_inline)) int decodeReport(const struct reportDescriptor* iDesc, struct dsDevice* iDevice,
+                                                              const unsigned char* iReport, unsigned int iTimestamp)
 {
-    return ksceKernelGetSystemTimeLow();
+    struct accelGyroData data;
+
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        data.accel[i] = decodeAxis(iReport, &iDesc->accel[i]);
+        data.gyro[i] = decodeAxis(iReport, &iDesc->gyro[i]);
+    }
+
+    // Without sensor time, arrival time is kept
+    if (REPORT_FIELD_NONE != iDesc->timestampOffset)
+    {
+        const unsigned char* field = &iReport[iDesc->timestampOffset];
+        unsigned int ticks = field[0] | (field[1] << 8);
+        if (4 == iDesc->timestampBytes)
+            ticks |= (field[2] << 16) | ((unsigned int)field[3] << 24);
+
+        unsigned int tickMask = (4 == iDesc->timestampBytes) ? 0xFFFFFFFF : 0xFFFF;
+        data.timestamp = controllerClockUpdate(&iDevice->clock, ticks, tickMask, iDesc->tickMul, iDesc->tickDiv, iTimestamp);
+    }
+    else
+    {
+        data.timestamp = iTimestamp;
+    }
+
+    int calibrationChanged = calibrationUpdate(&iDevice->calibration, &iDesc->scale, &data);
+    calibrationApply(&iDevice->calibration.values, &data);
+
+    writeSample(iDevice, &iDesc->scale, &data);
+    return calibrationChanged;
 }
 
-unsigned int dsGetCurrentCounter()
+// DS4 finger: 7-bit id, inactive bit, then 12-bit x and y packed over 3 bytes
+static void decodeFinger(const unsigned char* iField, volatile struct dsTouchFinger* oFinger)
 {
-    return globalCounter;
+    oFinger->id = iField[0] & 0x7F;
+    oFinger->active = !(iField[0] >> 7);
+    oFinger->x = iField[1] | ((iField[2] & 0x0F) << 8);
+    oFinger->y = (iField[2] >> 4) | (iField[3] << 4);
 }
 
-unsigned int dsGetSampledAccelGyro(unsigned int iSamplingTimeMS, signed short oAccel[3], signed short oGyro[3])
+#define DS4_TOUCH_PACKETS_OFFSET offsetof(struct ds4_input_report, trackpadpackets)
+#define DS4_FINGERS_OFFSET       (offsetof(struct ds4_input_report, packetcnt)+1)
+
+// DS4 touchpad state goes to the touch ring with the time of the sample just written
+static void decodeTouch(struct dsDevice* iDevice, const unsigned char* iReport)
 {
-    if (!ds3_connected && !ds4_connected)
-        return 0;
+    // Reports without touchpad packet don't give its state
+    if (0 == iReport[DS4_TOUCH_PACKETS_OFFSET])
+        return;
+
+    struct dsSharedDevice* ring = iDevice->ring;
+    unsigned int counter = iDevice->touchCounter+1;
+    volatile struct dsTouchData* slot = &ring->touches[counter & DS_TOUCH_HISTORY_MASK];
+
+    slot->counter = 0;
+    dsMemoryBarrier();
+
+    // Like the sensor axes, fields are read bytewise from the unaligned report buffer
+    decodeFinger(&iReport[DS4_FINGERS_OFFSET], &slot->fingers[0]);
+    decodeFinger(&iReport[DS4_FINGERS_OFFSET+4], &slot->fingers[1]);
+
+    slot->timestamp = iDevice->wideTimestamp;
+    dsMemoryBarrier();
 
-    int initIndex = currentData;
-    struct accelGyroData* data = &previousData[initIndex];
+    slot->counter = counter;
+    dsMemoryBarrier();
 
-    int accel_sum[3] = {data->accel[0], data->accel[1], data->accel[2]};
-    int gyro_sum[3] = {data->gyro[0], data->gyro[1], data->gyro[2]};
+    iDevice->touchCounter = counter;
+    ring->touchCounter = counter;
+}
 
-    unsigned int initTime = data->timestamp;
-    unsigned int samplingTimeNano = 1000 * iSamplingTimeMS;
+// Decodes a report matching the device type into the sample ring: returns 1 when calibration has to be saved
+static int storeReport(struct dsDevice* iDevice, const unsigned char* iReport, unsigned int iTimestamp)
+{
+    int calibrationChanged;
 
-    signed short index;
-    for (index = 1; index < NB_DATA; index++)
+    switch (iDevice->type)
     {
-        int dataIndex = (initIndex-index+NB_DATA)%NB_DATA;
-        data = &previousData[dataIndex];
-        
-        if (0 == data->counter || initTime-data->timestamp > samplingTimeNano)
-            break;
-        
-        accel_sum[0] += data->accel[0];
-        accel_sum[1] += data->accel[1];
-        accel_sum[2] += data->accel[2];
+    case DS_DEVICE_DS4:
+        calibrationChanged = decodeReport(&ds4Descriptor, iDevice, iReport, iTimestamp);
+        decodeTouch(iDevice, iReport);
+        return calibrationChanged;
+    case DS_DEVICE_DUALSENSE:
+        return decodeReport(&ds5Descriptor, iDevice, iReport, iTimestamp);
+    case DS_DEVICE_DS3:
+        return decodeReport(&ds3Descriptor, iDevice, iReport, iTimestamp);
+    }
+    return 0;
+}
+
+/*
+ * Report capture: records are appended to one of two memory buffers by the BlueTooth hook,
+ * a full buffer is written to the capture file by the I/O thread while the other one is filled.
+ */
+
+#define CAPTURE_PATH "ux0:data/dsmotion/capture.bin"
+#define CAPTURE_BUFFER_SIZE 0x4000
+
+#define IO_EVENT_CAPTURE 0x1
+#define IO_EVENT_EXIT    0x80000000
+
+static SceUID capture_fd = -1;
+static unsigned char captureBuffer[2][CAPTURE_BUFFER_SIZE];
+static volatile unsigned int captureLength[2] = {0, 0};
+static volatile int captureFull[2] = {0, 0};
+static int captureCurrent = 0;
+
+static SceUID io_evf = -1;
+static SceUID io_thread = -1;
+
+static void captureReport(int iDevice, const unsigned char* iReport, unsigned int iSize, unsigned int iTimestamp)
+{
+    if (capture_fd < 0)
+        return;
+
+    unsigned int recordSize = sizeof(struct dsCaptureRecord) + iSize;
+    if (captureLength[captureCurrent] + recordSize > CAPTURE_BUFFER_SIZE)
+    {
+        int next = 1 - captureCurrent;
+        if (captureFull[next])
+        {
+            // I/O thread is late: never wait in the BlueTooth hook
+            STAT_INC(droppedCaptures);
+            return;
+        }
 
-        gyro_sum[0] += data->gyro[0];
-        gyro_sum[1] += data->gyro[1];
-        gyro_sum[2] += data->gyro[2];
+        captureFull[captureCurrent] = 1;
+        ksceKernelSetEventFlag(io_evf, IO_EVENT_CAPTURE);
+        captureCurrent = next;
     }
-    
-    signed short accel[3] = {accel_sum[0] / index, accel_sum[1] / index, accel_sum[2] / index};
-    signed short gyro[3] = {gyro_sum[0] / index, gyro_sum[1] / index, gyro_sum[2] / index};
 
-    ksceKernelMemcpyKernelToUser((uintptr_t)oAccel, (const void *)accel, 3*sizeof(signed short));
-    ksceKernelMemcpyKernelToUser((uintptr_t)oGyro, (const void *)gyro, 3*sizeof(signed short));
+    unsigned char* dest = &captureBuffer[captureCurrent][captureLength[captureCurrent]];
+    struct dsCaptureRecord record = {iTimestamp, iSize, iDevice};
+    memcpy(dest, &record, sizeof(record));
+    memcpy(dest + sizeof(record), iReport, iSize);
 
-    return index;
+    captureLength[captureCurrent] += recordSize;
 }
 
-int dsGetInstantAccelGyro(unsigned int iIndex, struct accelGyroData* oData)
+static void captureFlush(int iAll)
+{
+    for (int i = 0 ; i < 2 ; i++)
+    {
+        if (captureFull[i] || (iAll && captureLength[i] > 0))
+        {
+            ksceIoWrite(capture_fd, captureBuffer[i], captureLength[i]);
+            captureLength[i] = 0;
+            dsMemoryBarrier();
+            captureFull[i] = 0;
+        }
+    }
+}
+
+static void captureOpen()
+{
+    // Capture is only enabled if the file already exists
+    capture_fd = ksceIoOpen(CAPTURE_PATH, SCE_O_WRONLY | SCE_O_APPEND, 0);
+    if (capture_fd < 0)
+        return;
+
+    // Records of this boot start after their own header
+    struct dsCaptureHeader header = {DS_CAPTURE_MAGIC, DS_CAPTURE_VERSION};
+    ksceIoWrite(capture_fd, &header, sizeof(header));
+}
+
+static void captureClose()
+{
+    if (capture_fd < 0)
+        return;
+
+    // Hooks are released: no report can be added meanwhile
+    captureFlush(1);
+    ksceIoClose(capture_fd);
+    capture_fd = -1;
+}
+
+/*
+ * Tracing: fixed size records are reserved in a ring per CPU without lock (a thread can be
+ * preempted by another one on the same CPU), the I/O thread writes them to the trace file.
+ * Records which don't fit in a full ring are only counted.
+ */
+
+#define TRACE_PATH "ux0:data/dsmotion/trace.bin"
+#define TRACE_CPUS 4
+#define TRACE_RING_SIZE 512 // Must be a power of 2
+#define TRACE_RING_MASK (TRACE_RING_SIZE-1)
+#define TRACE_FLUSH_PERIOD 500000 // us
+#define TRACE_WRITE_RECORDS 64
+
+#define IO_EVENT_TRACE 0x4
+
+struct traceRing
+{
+    volatile unsigned int head; // Next record to reserve
+    volatile unsigned int tail; // Next record to write, only moved by the I/O thread
+    volatile unsigned int lost;
+    struct dsTraceRecord records[TRACE_RING_SIZE];
+};
+
+static SceUID trace_fd = -1;
+static struct traceRing traceRings[TRACE_CPUS];
+
+#define TRACE(event, arg0, arg1, arg2) \
+    do { \
+        if (trace_fd >= 0) \
+            traceWrite((event), (arg0), (arg1), (arg2)); \
+    } while (0)
+
+static inline int traceCpu()
+{
+#ifdef __arm__
+    unsigned int mpidr;
+    __asm__ volatile ("mrc p15, 0, %0, c0, c0, 5" : "=r"(mpidr));
+    return mpidr & (TRACE_CPUS-1);
+#else
+    return 0;
+#endif
+}
+
+static void traceWrite(unsigned int iEvent, int iArg0, int iArg1, int iArg2)
+{
+    int cpu = traceCpu();
+    struct traceRing* ring = &traceRings[cpu];
+
+    unsigned int head = ring->head;
+    do
+    {
+        if (head - ring->tail >= TRACE_RING_SIZE)
+        {
+            __atomic_add_fetch(&ring->lost, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&ring->head, &head, head+1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    struct dsTraceRecord* record = &ring->records[head & TRACE_RING_MASK];
+    record->timestamp = ksceKernelGetSystemTimeLow();
+    record->event = iEvent;
+    record->cpu = cpu;
+    record->reserved = 0;
+    record->args[0] = iArg0;
+    record->args[1] = iArg1;
+    record->args[2] = iArg2;
+
+    // Record is complete once its sequence is set
+    __atomic_store_n(&record->sequence, head+1, __ATOMIC_RELEASE);
+
+    if (TRACE_RING_SIZE/2 == head - ring->tail && io_evf >= 0)
+        ksceKernelSetEventFlag(io_evf, IO_EVENT_TRACE);
+}
+
+static void traceFlush()
+{
+    static struct dsTraceRecord buffer[TRACE_WRITE_RECORDS];
+    int nbRecords = 0;
+
+    for (int cpu = 0 ; cpu < TRACE_CPUS ; cpu++)
+    {
+        struct traceRing* ring = &traceRings[cpu];
+
+        unsigned int lost = __atomic_exchange_n(&ring->lost, 0, __ATOMIC_RELAXED);
+        if (lost > 0)
+        {
+            struct dsTraceRecord record = {0, ksceKernelGetSystemTimeLow(), DS_TRACE_LOST, cpu, 0, {lost, 0, 0}};
+            buffer[nbRecords++] = record;
+        }
+
+        // Records still being written stop the copy until next flush
+        unsigned int tail = ring->tail;
+        while (tail != ring->head)
+        {
+            const struct dsTraceRecord* record = &ring->records[tail & TRACE_RING_MASK];
+            if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != tail+1)
+                break;
+
+            buffer[nbRecords++] = *record;
+            __atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+
+            if (TRACE_WRITE_RECORDS == nbRecords)
+            {
+                ksceIoWrite(trace_fd, buffer, sizeof(buffer));
+                nbRecords = 0;
+            }
+        }
+
+        if (nbRecords >= TRACE_WRITE_RECORDS-1)
+        {
+            ksceIoWrite(trace_fd, buffer, nbRecords*sizeof(struct dsTraceRecord));
+            nbRecords = 0;
+        }
+    }
+
+    if (nbRecords > 0)
+        ksceIoWrite(trace_fd, buffer, nbRecords*sizeof(struct dsTraceRecord));
+}
+
+static void traceOpen()
+{
+    // Tracing is only enabled if the file already exists
+    SceUID fd = ksceIoOpen(TRACE_PATH, SCE_O_WRONLY | SCE_O_APPEND, 0);
+    if (fd < 0)
+        return;
+
+    // Each start gets its header: timestamps of the records after it restart from this boot
+    struct dsTraceHeader header = {DS_TRACE_MAGIC, DS_TRACE_VERSION, ksceKernelGetSystemTimeLow(), {0, 0, 0}};
+    ksceIoWrite(fd, &header, sizeof(header));
+
+    trace_fd = fd;
+}
+
+static void traceClose()
 {
-    if (!ds3_connected && !ds4_connected)
+    if (trace_fd < 0)
+        return;
+
+    traceFlush();
+
+    SceUID fd = trace_fd;
+    trace_fd = -1;
+    ksceIoClose(fd);
+}
+
+int dsTrace(unsigned int iEvent, int iArg0, int iArg1, int iArg2)
+{
+    if (trace_fd < 0)
         return -1;
 
-    int curIndex = (currentData-(iIndex%NB_DATA)+NB_DATA)%NB_DATA;
-    ksceKernelMemcpyKernelToUser((uintptr_t)oData, (const void *)&previousData[curIndex], sizeof(struct accelGyroData));
+    // Kernel events can't be given by user processes
+    if (iEvent < DS_TRACE_USER_FIRST || iEvent > 0xFFFF)
+        return -1;
 
+    traceWrite(iEvent, iArg0, iArg1, iArg2);
     return 0;
 }
 
-static inline void ds3_input_reset(void)
+/*
+ * Device identity cache: controller type of each BlueTooth address met (DS_DEVICE_NONE for other devices),
+ * so that BlueTooth queries are done once per device, and controller calibration.
+ * It is loaded at start and saved by the I/O thread. Entries are only written by the BlueTooth hook:
+ * each one has a sequence counter, odd while it is written, so that the I/O thread copies consistent entries.
+ */
+
+#define IDENTITY_DIR "ux0:data/dsmotion"
+#define IDENTITY_PATH "ux0:data/dsmotion/devices.bin"
+#define IDENTITY_MAGIC 0x56444D44 // "DMDV"
+#define IDENTITY_VERSION 2
+
+#define IDENTITY_CACHE_SIZE 32 // Must be a power of 2
+#define IDENTITY_CACHE_MASK (IDENTITY_CACHE_SIZE-1)
+#define IDENTITY_MAX_PROBES 4
+
+#define IO_EVENT_IDENTITY 0x2
+
+struct deviceIdentity
+{
+    unsigned int mac0;
+    unsigned int mac1;
+    int type;
+    int valid;
+    struct calibration calibration;
+};
+
+struct identityHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int count;
+};
+
+static struct deviceIdentity identityCache[IDENTITY_CACHE_SIZE];
+static volatile unsigned int identitySequence[IDENTITY_CACHE_SIZE];
+
+static void identityWriteBegin(const struct deviceIdentity* iIdentity)
+{
+    identitySequence[iIdentity - identityCache]++;
+    dsMemoryBarrier();
+}
+
+static void identityWriteEnd(const struct deviceIdentity* iIdentity)
+{
+    dsMemoryBarrier();
+    identitySequence[iIdentity - identityCache]++;
+}
+
+static unsigned int identityHash(unsigned int iMac0, unsigned int iMac1)
+{
+    return ((iMac0 ^ (iMac1 * 0x9E3779B1)) * 0x9E3779B1) >> 16;
+}
+
+static struct deviceIdentity* findIdentity(unsigned int iMac0, unsigned int iMac1)
+{
+    unsigned int index = identityHash(iMac0, iMac1);
+    for (int i = 0 ; i < IDENTITY_MAX_PROBES ; i++)
+    {
+        struct deviceIdentity* identity = &identityCache[(index + i) & IDENTITY_CACHE_MASK];
+        if (!identity->valid)
+            break;
+        if (iMac0 == identity->mac0 && iMac1 == identity->mac1)
+            return identity;
+    }
+    return NULL;
+}
+
+static struct deviceIdentity* storeIdentity(unsigned int iMac0, unsigned int iMac1, int iType)
+{
+    unsigned int index = identityHash(iMac0, iMac1);
+
+    // When all probed entries are used, the first one is replaced
+    struct deviceIdentity* identity = &identityCache[index & IDENTITY_CACHE_MASK];
+    for (int i = 0 ; i < IDENTITY_MAX_PROBES ; i++)
+    {
+        struct deviceIdentity* probed = &identityCache[(index + i) & IDENTITY_CACHE_MASK];
+        if (!probed->valid)
+        {
+            identity = probed;
+            break;
+        }
+    }
+
+    identityWriteBegin(identity);
+    identity->valid = 0;
+    dsMemoryBarrier();
+    identity->mac0 = iMac0;
+    identity->mac1 = iMac1;
+    identity->type = iType;
+    memset(&identity->calibration, 0, sizeof(identity->calibration));
+    dsMemoryBarrier();
+    identity->valid = 1;
+    identityWriteEnd(identity);
+
+    if (io_evf >= 0)
+        ksceKernelSetEventFlag(io_evf, IO_EVENT_IDENTITY);
+
+    return identity;
+}
+
+// Calibration of a connected controller goes to its identity, to be saved
+static void identityUpdateCalibration(struct dsDevice* iDevice)
+{
+    struct deviceIdentity* identity = iDevice->identity;
+    if (NULL == identity || identity->mac0 != iDevice->mac0 || identity->mac1 != iDevice->mac1)
+        return;
+
+    identityWriteBegin(identity);
+    identity->calibration = iDevice->calibration.values;
+    identityWriteEnd(identity);
+
+    if (io_evf >= 0)
+        ksceKernelSetEventFlag(io_evf, IO_EVENT_IDENTITY);
+}
+
+// Types written by another version may be unknown: these entries are dropped
+static int identityTypeKnown(int iType)
+{
+    return DS_DEVICE_NONE == iType || NULL != getReportDescriptor(iType);
+}
+
+static void identityLoad()
+{
+    SceUID fd = ksceIoOpen(IDENTITY_PATH, SCE_O_RDONLY, 0);
+    if (fd < 0)
+        return;
+
+    static struct deviceIdentity identities[IDENTITY_CACHE_SIZE];
+    struct identityHeader header;
+    int valid = (ksceIoRead(fd, &header, sizeof(header)) == sizeof(header)
+                 && IDENTITY_MAGIC == header.magic && IDENTITY_VERSION == header.version && IDENTITY_CACHE_SIZE == header.count
+                 && ksceIoRead(fd, identities, sizeof(identities)) == sizeof(identities));
+    ksceIoClose(fd);
+
+    if (!valid)
+        return;
+
+    // Kept entries are stored again: a dropped one must not end the probe sequence of the following ones
+    memset(identityCache, 0, sizeof(identityCache));
+    for (int i = 0 ; i < IDENTITY_CACHE_SIZE ; i++)
+    {
+        struct deviceIdentity* loaded = &identities[i];
+        if (!loaded->valid || !identityTypeKnown(loaded->type) || NULL != findIdentity(loaded->mac0, loaded->mac1))
+            continue;
+
+        unsigned int index = identityHash(loaded->mac0, loaded->mac1);
+        for (int j = 0 ; j < IDENTITY_MAX_PROBES ; j++)
+        {
+            struct deviceIdentity* identity = &identityCache[(index + j) & IDENTITY_CACHE_MASK];
+            if (!identity->valid)
+            {
+                *identity = *loaded;
+                identity->valid = 1;
+                break;
+            }
+        }
+    }
+}
+
+static void identitySave()
 {
-	memset(&ds3_input, 0, sizeof(ds3_input));
+    // Entries being written keep their previous copy, they are saved again once written
+    static struct deviceIdentity identities[IDENTITY_CACHE_SIZE];
+    for (int i = 0 ; i < IDENTITY_CACHE_SIZE ; i++)
+    {
+        for (int retry = 0 ; retry < DS_READ_RETRIES ; retry++)
+        {
+            unsigned int sequence = identitySequence[i];
+            if (sequence & 1)
+                continue;
+
+            struct deviceIdentity identity;
+            dsMemoryBarrier();
+            memcpy(&identity, &identityCache[i], sizeof(identity));
+            dsMemoryBarrier();
+
+            if (identitySequence[i] == sequence)
+            {
+                identities[i] = identity;
+                break;
+            }
+        }
+    }
+
+    ksceIoMkdir(IDENTITY_DIR, 0777);
+
+    SceUID fd = ksceIoOpen(IDENTITY_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+    if (fd < 0)
+        return;
+
+    struct identityHeader header = {IDENTITY_MAGIC, IDENTITY_VERSION, IDENTITY_CACHE_SIZE};
+    ksceIoWrite(fd, &header, sizeof(header));
+    ksceIoWrite(fd, identities, sizeof(identities));
+    ksceIoClose(fd);
 }
 
-static inline void ds4_input_reset(void)
+// File writes are done in this thread to stay out of the BlueTooth hook
+static int io_thread_func(SceSize args, void *argp)
 {
-	memset(&ds4_input, 0, sizeof(ds4_input));
+    for (;;)
+    {
+        // Traces are also written periodically
+        unsigned int events = 0;
+        SceUInt timeout = TRACE_FLUSH_PERIOD;
+        int res = ksceKernelWaitEventFlag(io_evf, IO_EVENT_CAPTURE | IO_EVENT_IDENTITY | IO_EVENT_TRACE | IO_EVENT_EXIT, SCE_EVENT_WAITOR | SCE_EVENT_WAITCLEAR,
+                                          &events, (trace_fd >= 0) ? &timeout : NULL);
+        if (SCE_KERNEL_ERROR_WAIT_TIMEOUT == res)
+            events = IO_EVENT_TRACE;
+        else if (res < 0)
+            break;
+
+        if (events & IO_EVENT_CAPTURE)
+            captureFlush(0);
+
+        if ((events & IO_EVENT_TRACE) && trace_fd >= 0)
+            traceFlush();
+
+        if (events & IO_EVENT_IDENTITY)
+            identitySave();
+
+        if (events & IO_EVENT_EXIT)
+            break;
+    }
+
+    return 0;
 }
 
-static int is_ds3(const unsigned short vid_pid[2])
+static void setGeneration(struct dsDevice* ioDevice)
 {
-	return vid_pid[0] == SONY_VID && vid_pid[1] == DS3_PID;
+    if (0 == ++connectionGeneration)
+        connectionGeneration = 1;
+
+    // Readers seeing the new generation also see the counter reset
+    dsMemoryBarrier();
+    ioDevice->generation = connectionGeneration;
+    ioDevice->ring->generation = connectionGeneration;
 }
 
-static int is_ds4(const unsigned short vid_pid[2])
+static void connectDevice(struct dsDevice* iDevice, unsigned int iMac0, unsigned int iMac1)
 {
-	return (vid_pid[0] == SONY_VID) && ((vid_pid[1] == DS4_PID) || (vid_pid[1] == DS4_2_PID));
+    // Reconnection of a known controller: its samples start over
+    if (NULL != iDevice)
+    {
+        STAT_INC(reconnections);
+        TRACE(DS_TRACE_CONNECT, iDevice-devices, iDevice->type, 1);
+        iDevice->recv_buff = NULL;
+        iDevice->counter = iDevice->touchCounter = 0;
+        iDevice->ring->counter = 0;
+        iDevice->ring->touchCounter = 0;
+        iDevice->clock.valid = 0;
+        setGeneration(iDevice);
+        return;
+    }
+
+    int type;
+    struct deviceIdentity* identity = findIdentity(iMac0, iMac1);
+    if (NULL != identity)
+    {
+        type = identity->type;
+    }
+    else
+    {
+        unsigned short vid_pid[2];
+        unsigned int result1 = ksceBtGetVidPid(iMac0, iMac1, vid_pid);
+        TRACE(DS_TRACE_VID_PID, vid_pid[0], vid_pid[1], result1);
+
+        type = getDeviceTypeFromVidPid(vid_pid);
+        if (DS_DEVICE_NONE == type)
+        {
+            // Some DS3 don't give their identifiers
+            char name[0x79];
+            unsigned int result2 = ksceBtGetDeviceName(iMac0, iMac1, name);
+            if (result1 == 0x802F5001 && result2 == 0x802F0C01)
+                type = DS_DEVICE_DS3;
+        }
+
+        // Other devices are only remembered once they gave their identifiers
+        if (DS_DEVICE_NONE != type || 0 == result1)
+            identity = storeIdentity(iMac0, iMac1, type);
+    }
+
+    if (DS_DEVICE_NONE == type)
+    {
+        TRACE(DS_TRACE_CONNECT, -1, type, 0);
+        return;
+    }
+
+    for (int i = 0 ; i < DS_MAX_DEVICES ; i++)
+    {
+        struct dsDevice* device = &devices[i];
+        if (DS_DEVICE_NONE == device->type)
+        {
+            device->mac0 = iMac0;
+            device->mac1 = iMac1;
+            device->recv_buff = NULL;
+            device->counter = device->touchCounter = 0;
+            device->ring->counter = 0;
+            device->ring->touchCounter = 0;
+            device->clock.valid = 0;
+            setGeneration(device);
+            device->identity = identity;
+            calibrationReset(&device->calibration, (NULL != identity) ? &identity->calibration : NULL);
+            dsMemoryBarrier();
+
+            // Readers only consider the device once it is fully initialized
+            device->type = type;
+            device->ring->type = type;
+            STAT_INC(connections);
+            updatePrimaryDevice();
+            TRACE(DS_TRACE_CONNECT, i, type, 0);
+            return;
+        }
+    }
 }
 
 #define DECL_FUNC_HOOK(name, ...) \
@@ -297,98 +2492,66 @@ DECL_FUNC_HOOK(SceBt_ksceBtReadEvent, SceBtEvent *events, int num_events)
 
 	if (ret >= 0)
     {
+        unsigned int hookStart = ksceKernelGetSystemTimeLow();
+
         for (int i = 0 ; i < num_events ; i++)
         {
             SceBtEvent* event = &events[i];
-            //LOG("Connection event %d with %d %d\n", event->id, event->mac0, event->mac1);
+            struct dsDevice* device = findDevice(event->mac0, event->mac1);
+            TRACE(DS_TRACE_BT_EVENT, event->id, (NULL != device) ? device-devices : -1, NULL != device && NULL != device->recv_buff);
 
-            if (!ds3_connected && !ds4_connected && 0x05 == event->id)
+            if (0x05 == event->id)
             {
-                unsigned short vid_pid[2];
-                unsigned int result1 = ksceBtGetVidPid(event->mac0, event->mac1, vid_pid);
-                //LOG("Vendor ID %d ; Product ID %d\n", vid_pid[0], vid_pid[1]);
-                //log_flush();
-
-                int connected = 0;
-                if (is_ds4(vid_pid))
-                {
-                    ds4_input_reset();
-                    ds4_connected = 1;
-                    connected = 1;
-                }
-                else
-                {
-                    char name[0x79];
-                    unsigned int result2 = ksceBtGetDeviceName(event->mac0, event->mac1, name);
-                    if (is_ds3(vid_pid)|| (result1 == 0x802F5001 && result2 == 0x802F0C01))
-                    {
-                        ds3_input_reset();
-                        ds3_connected = 1;
-                        connected = 1;
-                    }
-                }
-                
-                if (connected)
-                {
-                    ds_mac0 = event->mac0;
-                    ds_mac1 = event->mac1;
-                    globalCounter = 0;
-                }
+                connectDevice(device, event->mac0, event->mac1);
             }
-            else if ((ds3_connected || ds4_connected) && event->mac0 == ds_mac0 && event->mac1 == ds_mac1)
+            else if (NULL != device)
             {
                 if (0x06 == event->id)
                 {
-                    ds3_connected = 0;
-                    ds4_connected = 0;
+                    device->type = DS_DEVICE_NONE;
+                    device->ring->type = DS_DEVICE_NONE;
+                    updatePrimaryDevice();
+
+                    // Waiters of this device return
+                    if (sample_evf >= 0)
+                        ksceKernelSetEventFlag(sample_evf, SAMPLE_EVF_DEVICE_BITS(device-devices));
+                    STAT_INC(disconnections);
+                    TRACE(DS_TRACE_DISCONNECT, device-devices, 0, 0);
                 }
-                else if (NULL != recv_buff)
+                else if (NULL != device->recv_buff)
                 {
                     if (0x0A == event->id)
                     {
-                        if ((ds4_connected && 0x11 == recv_buff[0]) || (ds3_connected && 0x01 == recv_buff[0]))
+                        int accepted = (getReportId(device->type) == device->recv_buff[0]);
+                        statsReport(device->recv_buff[0], accepted);
+
+                        if (accepted)
+                        {
+                            unsigned int timestamp = ksceKernelGetSystemTimeLow();
+                            statsArrival(device, timestamp);
+                            captureReport(device-devices, device->recv_buff, getReportSize(device->type), timestamp);
+                            if (storeReport(device, device->recv_buff, timestamp))
+                                identityUpdateCalibration(device);
+                            TRACE(DS_TRACE_REPORT, device-devices, device->recv_buff[0], device->counter);
+                        }
+                        else
                         {
-                            int newData = (currentData+1)%NB_DATA;
-                            struct accelGyroData* data = &previousData[newData];
-
-                            if (ds4_connected)
-                            {
-                                memcpy(&ds4_input, recv_buff, sizeof(ds4_input));
-
-                                // Data from gyroscope and accelerometer seem inverted on DS4
-                                data->accel[0] = ds4_input.gyro_x;
-                                data->accel[1] = ds4_input.gyro_y;
-                                data->accel[2] = ds4_input.gyro_z;
-
-                                data->gyro[0] = ds4_input.accel_x;
-                                data->gyro[1] = ds4_input.accel_y;
-                                data->gyro[2] = ds4_input.accel_z;
-                            }
-                            else // if (ds3_connected)
-                            {
-                                memcpy(&ds3_input, recv_buff, sizeof(ds3_input));
-
-                                // DS3 matching with DS4
-                                data->accel[0] = -((signed short)ds3_input.accel_y)/4;
-                                data->accel[1] = -((signed short)ds3_input.accel_z)/4;
-                                data->accel[2] = ((signed short)ds3_input.accel_x)/4;
-
-                                data->gyro[0] = 0;
-                                data->gyro[1] = ((signed short)ds3_input.gyro_z+0x15FF)/10;
-                                data->gyro[2] = 0;
-                            }
-
-                            data->timestamp = ksceKernelGetSystemTimeLow();
-                            data->counter = (++globalCounter);
-                            currentData = newData;
+                            TRACE(DS_TRACE_REPORT_REJECTED, device-devices, device->recv_buff[0], getReportId(device->type));
                         }
-                        recv_buff = NULL;
+                        device->recv_buff = NULL;
                     }
                     else if (0x0B == event->id || 0x0C == event->id)
-                        recv_buff = NULL;
+                    {
+                        STAT_INC(cancelledTransfers);
+                        device->recv_buff = NULL;
+                    }
                 }
             }
         }
+
+        unsigned int duration = ksceKernelGetSystemTimeLow() - hookStart;
+        statsHookLatency(duration);
+        TRACE(DS_TRACE_READ_EVENT_END, num_events, duration, 0);
 	}
 
 	return ret;
@@ -398,12 +2561,25 @@ DECL_FUNC_HOOK(SceBt_ksceBtHidTransfer, unsigned int mac0, unsigned int mac1, Sc
 {
 	int ret = TAI_CONTINUE(int, SceBt_ksceBtHidTransfer_ref, mac0, mac1, request);
 
-    if (ret >= 0 && (ds3_connected || ds4_connected) && mac0 == ds_mac0 && mac1 == ds_mac1)
+    if (ret >= 0)
     {
-        if (NULL != request && NULL != request->buffer && request->length >= (ds4_connected?sizeof(ds4_input):sizeof(ds3_input)))
-            recv_buff = (unsigned char*)request->buffer;
-        else
-            recv_buff = NULL;
+        struct dsDevice* device = findDevice(mac0, mac1);
+        if (NULL != device)
+        {
+            TRACE(DS_TRACE_HID_TRANSFER, device-devices, (NULL != request) ? (int)request->length : -1,
+                  NULL != request && NULL != request->buffer && request->length >= getReportSize(device->type));
+
+            if (NULL != request && NULL != request->buffer && request->length >= getReportSize(device->type))
+            {
+                device->recv_buff = (unsigned char*)request->buffer;
+            }
+            else
+            {
+                if (NULL != request && NULL != request->buffer)
+                    STAT_INC(smallBuffers);
+                device->recv_buff = NULL;
+            }
+        }
     }
     
     return ret;
@@ -420,29 +2596,48 @@ int module_start(SceSize argc, const void *args)
 	int ret;
 	tai_module_info_t SceBt_modinfo;
 
-	//log_reset();
-	//LOG("dsmotion kernel by OperationNT\n");
+    traceOpen();
 
 	SceBt_modinfo.size = sizeof(SceBt_modinfo);
 	ret = taiGetModuleInfoForKernel(KERNEL_PID, "SceBt", &SceBt_modinfo);
 	if (ret < 0) {
-		//LOG("Error finding SceBt module\n");
+		TRACE(DS_TRACE_MODULE_START, ret, -1, -1);
+		traceClose();
 		goto error_find_scebt;
 	}
 
+    sharedOpen();
+    identityLoad();
+    sample_evf = ksceKernelCreateEventFlag("dsmotion_sample", SCE_EVENT_WAITMULTIPLE, 0, NULL);
+
 	/* SceBt hooks */
 	BIND_FUNC_EXPORT_HOOK(SceBt_ksceBtReadEvent, KERNEL_PID, "SceBt", TAI_ANY_LIBRARY, 0x5ABB9A9D);
-    //LOG("ksceBtReadEvent hook result: %x\n", SceBt_ksceBtReadEvent_hook_uid);
-
 	BIND_FUNC_EXPORT_HOOK(SceBt_ksceBtHidTransfer, KERNEL_PID, "SceBt", TAI_ANY_LIBRARY, 0xF9DCEC77);
-    //LOG("ksceBtHidTransfer hook result: %x\n", SceBt_ksceBtHidTransfer_hook_uid);
+    TRACE(DS_TRACE_MODULE_START, ret, SceBt_ksceBtReadEvent_hook_uid, SceBt_ksceBtHidTransfer_hook_uid);
     
-	//LOG("module_start finished successfully!\n");
-    //log_flush();
-    
-    memset(previousData, 0, sizeof(previousData));
+    io_evf = ksceKernelCreateEventFlag("dsmotion_io", SCE_EVENT_WAITMULTIPLE, 0, NULL);
+    io_thread = ksceKernelCreateThread("dsmotion_io", io_thread_func, 0x3C, 0x1000, 0, 0x10000, 0);
+    if (io_evf >= 0 && io_thread >= 0)
+    {
+        captureOpen();
+        if (ksceKernelStartThread(io_thread, 0, NULL) < 0)
+        {
+            captureClose();
+            ksceKernelDeleteThread(io_thread);
+            io_thread = -1;
+        }
+    }
+    else if (io_thread >= 0)
+    {
+        ksceKernelDeleteThread(io_thread);
+        io_thread = -1;
+    }
+
+    // Nothing would write the trace records: records so far are written now and tracing stops
+    if (io_thread < 0)
+        traceClose();
 
-	return SCE_KERNEL_START_SUCCESS;
+    return SCE_KERNEL_START_SUCCESS;
 
 error_find_scebt:
 	return SCE_KERNEL_START_FAILED;
@@ -460,7 +2655,27 @@ int module_stop(SceSize argc, const void *args)
 	UNBIND_FUNC_HOOK(SceBt_ksceBtReadEvent);
     UNBIND_FUNC_HOOK(SceBt_ksceBtHidTransfer);
 
-	//log_flush();
+    if (io_thread >= 0)
+    {
+        ksceKernelSetEventFlag(io_evf, IO_EVENT_EXIT);
+        ksceKernelWaitThreadEnd(io_thread, NULL, NULL);
+        ksceKernelDeleteThread(io_thread);
+    }
+
+    captureClose();
+    traceClose();
+
+    if (io_evf >= 0)
+    {
+        ksceKernelDeleteEventFlag(io_evf);
+    }
+
+    if (sample_evf >= 0)
+    {
+        ksceKernelDeleteEventFlag(sample_evf);
+    }
+
+    sharedClose();
 
 	return SCE_KERNEL_STOP_SUCCESS;
 }
@@ -0,0 +1,117 @@
+/*
+ * Conversion benchmark: blocks of samples converted into SceMotionSensorState records
+ * by the user plugin convertAccelGyro (NEON on ARM, axis table loop elsewhere)
+ * against the former open-coded loop, which divided each component.
+ * Usage: bench_convert [blocks]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../user/main.c"
+
+static void referenceConvert(const struct accelGyroData* iData, int iCount, SceMotionSensorState* oStates)
+{
+    for (int i = 0 ; i < iCount ; i++)
+    {
+        const struct accelGyroData* data = &iData[i];
+        SceMotionSensorState* curState = &oStates[i];
+
+        curState->accelerometer.x = -(float)data->accel[2] / 0x2000;
+        curState->accelerometer.y = (float)data->accel[0] / 0x2000;
+        curState->accelerometer.z = -(float)data->accel[1] / 0x2000;
+
+        curState->gyro.x = (float)data->gyro[0] / 2607.6f;
+        curState->gyro.y = -(float)data->gyro[2] / 2607.6f;
+        curState->gyro.z = (float)data->gyro[1] / 2607.6f;
+    }
+}
+
+static void fillSamples(struct accelGyroData* oData, int iCount)
+{
+    unsigned int seed = 12345;
+    for (int i = 0 ; i < iCount ; i++)
+    {
+        for (int j = 0 ; j < 3 ; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            oData[i].accel[j] = (signed short)(seed >> 16);
+            seed = seed * 1103515245 + 12345;
+            oData[i].gyro[j] = (signed short)(seed >> 16);
+        }
+        oData[i].timestamp = i * 4000;
+        oData[i].counter = i + 1;
+    }
+}
+
+static float relativeError(float iValue, float iReference)
+{
+    float error = fabsf(iValue - iReference);
+    return (0.f != iReference) ? error / fabsf(iReference) : error;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int blocks = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+    HOST_CHECK(blocks > 0);
+
+    struct motionProfile defaultProfile;
+    memset(&defaultProfile, 0, sizeof(defaultProfile));
+    memcpy(defaultProfile.axisSource, defaultAxisSource, sizeof(defaultAxisSource));
+    memcpy(defaultProfile.axisSign, defaultAxisSign, sizeof(defaultAxisSign));
+    setAxisTable(&defaultProfile);
+    initAxisConversion();
+
+    static struct accelGyroData samples[MAX_SENSOR_RECORDS];
+    static SceMotionSensorState converted[MAX_SENSOR_RECORDS];
+    static SceMotionSensorState reference[MAX_SENSOR_RECORDS];
+    fillSamples(samples, MAX_SENSOR_RECORDS);
+
+    // Default table must give the former values, only rounded differently (product instead of division)
+    convertAccelGyro(samples, MAX_SENSOR_RECORDS, &converted[0].accelerometer.x, sizeof(SceMotionSensorState));
+    referenceConvert(samples, MAX_SENSOR_RECORDS, reference);
+
+    float maxError = 0.f;
+    for (int i = 0 ; i < MAX_SENSOR_RECORDS ; i++)
+    {
+        const float* values = &converted[i].accelerometer.x;
+        const float* expected = &reference[i].accelerometer.x;
+        const float* gyroValues = &converted[i].gyro.x;
+        const float* gyroExpected = &reference[i].gyro.x;
+        for (int j = 0 ; j < 3 ; j++)
+        {
+            maxError = fmaxf(maxError, relativeError(values[j], expected[j]));
+            maxError = fmaxf(maxError, relativeError(gyroValues[j], gyroExpected[j]));
+        }
+    }
+    HOST_CHECK(maxError < 1e-6f);
+
+    float checksum = 0.f;
+    unsigned long long start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < blocks ; i++)
+    {
+        convertAccelGyro(samples, MAX_SENSOR_RECORDS, &converted[0].accelerometer.x, sizeof(SceMotionSensorState));
+        checksum += converted[i % MAX_SENSOR_RECORDS].gyro.z;
+    }
+    unsigned long long tableDuration = hostNanoseconds() - start;
+
+    start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < blocks ; i++)
+    {
+        referenceConvert(samples, MAX_SENSOR_RECORDS, reference);
+        checksum += reference[i % MAX_SENSOR_RECORDS].gyro.z;
+    }
+    unsigned long long referenceDuration = hostNanoseconds() - start;
+
+    double records = (double)blocks * MAX_SENSOR_RECORDS;
+    printf("%u blocks of %d records, max relative difference %g (checksum %g)\n", blocks, MAX_SENSOR_RECORDS, maxError, checksum);
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+    printf("convertAccelGyro (NEON)   %6.2f ns/record\n", tableDuration / records);
+#else
+    printf("convertAccelGyro (table)  %6.2f ns/record\n", tableDuration / records);
+#endif
+    printf("former loop               %6.2f ns/record\n", referenceDuration / records);
+    return 0;
+}
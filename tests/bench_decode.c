@@ -0,0 +1,214 @@
+/*
+ * Report decoding benchmark: the specialized extraction of each report descriptor against
+ * the former decoding, which copied the whole report to read its sensor fields.
+ * Also measures storeReport, the complete per report cost (clock, calibration, ring, filter, fusion),
+ * and checks the DS4 touchpad decoding from unaligned buffers against the report bitfields.
+ * Usage: bench_decode [reports]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define NB_REPORTS 1024
+#define REPORT_PERIOD_US 1000
+
+typedef void (*extractFunc)(const unsigned char* iReport, struct accelGyroData* oData);
+
+// Sensor part of decodeReport
+static inline __attribute__((always_inline)) void extractSample(const struct reportDescriptor* iDesc, const unsigned char* iReport, struct accelGyroData* oData)
+{
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        oData->accel[i] = decodeAxis(iReport, &iDesc->accel[i]);
+        oData->gyro[i] = decodeAxis(iReport, &iDesc->gyro[i]);
+    }
+}
+
+static void extractDS4(const unsigned char* iReport, struct accelGyroData* oData)
+{
+    extractSample(&ds4Descriptor, iReport, oData);
+}
+
+static void extractDS5(const unsigned char* iReport, struct accelGyroData* oData)
+{
+    extractSample(&ds5Descriptor, iReport, oData);
+}
+
+static void extractDS3(const unsigned char* iReport, struct accelGyroData* oData)
+{
+    extractSample(&ds3Descriptor, iReport, oData);
+}
+
+static struct ds4_input_report ds4_input;
+static struct ds3_input_report ds3_input;
+
+static void formerDS4(const unsigned char* iReport, struct accelGyroData* oData)
+{
+    memcpy(&ds4_input, iReport, sizeof(ds4_input));
+
+    oData->accel[0] = ds4_input.gyro_x;
+    oData->accel[1] = ds4_input.gyro_y;
+    oData->accel[2] = ds4_input.gyro_z;
+
+    oData->gyro[0] = ds4_input.accel_x;
+    oData->gyro[1] = ds4_input.accel_y;
+    oData->gyro[2] = ds4_input.accel_z;
+}
+
+static void formerDS3(const unsigned char* iReport, struct accelGyroData* oData)
+{
+    memcpy(&ds3_input, iReport, sizeof(ds3_input));
+
+    oData->accel[0] = -((signed short)ds3_input.accel_y)/4;
+    oData->accel[1] = -((signed short)ds3_input.accel_z)/4;
+    oData->accel[2] = ((signed short)ds3_input.accel_x)/4;
+
+    oData->gyro[0] = 0;
+    oData->gyro[1] = ((signed short)ds3_input.gyro_z+0x15FF)/10;
+    oData->gyro[2] = 0;
+}
+
+struct decodeCase
+{
+    const char* name;
+    const struct reportDescriptor* desc;
+    extractFunc extract;
+    extractFunc former; // NULL for controllers added with the descriptors
+};
+
+static const struct decodeCase cases[] =
+{
+    {"DS4", &ds4Descriptor, extractDS4, formerDS4},
+    {"DualSense", &ds5Descriptor, extractDS5, NULL},
+    {"DS3", &ds3Descriptor, extractDS3, formerDS3},
+};
+
+// Random sensor values, controller clock going forward at the report period
+static void makeReports(const struct reportDescriptor* iDesc, unsigned char oReports[NB_REPORTS][256])
+{
+    unsigned int seed = 12345;
+    for (int i = 0 ; i < NB_REPORTS ; i++)
+    {
+        unsigned char* report = oReports[i];
+        for (int j = 0 ; j < 256 ; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            report[j] = seed >> 24;
+        }
+        report[0] = iDesc->reportId;
+
+        if (REPORT_FIELD_NONE != iDesc->timestampOffset)
+        {
+            unsigned int ticks = i * REPORT_PERIOD_US * iDesc->tickDiv / iDesc->tickMul;
+            for (int j = 0 ; j < iDesc->timestampBytes ; j++)
+                report[iDesc->timestampOffset + j] = ticks >> (8*j);
+        }
+    }
+}
+
+// Touch fields read bytewise must match the bitfields of an aligned copy, whatever the buffer alignment
+static void checkTouch(unsigned char iReports[NB_REPORTS][256])
+{
+    struct dsDevice* device = &devices[0];
+    device->touchCounter = 0;
+    device->ring->touchCounter = 0;
+
+    static unsigned char buffer[256+1];
+    for (int i = 0 ; i < NB_REPORTS ; i++)
+    {
+        unsigned char* report = &buffer[i & 1];
+        memcpy(report, iReports[i], sizeof(ds4_input));
+        memcpy(&ds4_input, iReports[i], sizeof(ds4_input));
+
+        unsigned int counter = device->touchCounter;
+        decodeTouch(device, report);
+        if (0 == ds4_input.trackpadpackets)
+        {
+            HOST_CHECK(counter == device->touchCounter);
+            continue;
+        }
+
+        const volatile struct dsTouchFinger* fingers = device->ring->touches[device->touchCounter & DS_TOUCH_HISTORY_MASK].fingers;
+        HOST_CHECK(fingers[0].x == ds4_input.finger1_x && fingers[0].y == ds4_input.finger1_y);
+        HOST_CHECK(fingers[0].id == ds4_input.finger1_id && fingers[0].active == !ds4_input.finger1_activelow);
+        HOST_CHECK(fingers[1].x == ds4_input.finger2_x && fingers[1].y == ds4_input.finger2_y);
+        HOST_CHECK(fingers[1].id == ds4_input.finger2_id && fingers[1].active == !ds4_input.finger2_activelow);
+    }
+}
+
+static double measureExtract(extractFunc iExtract, unsigned char iReports[NB_REPORTS][256], unsigned int iCount, int* ioChecksum)
+{
+    struct accelGyroData data;
+    unsigned long long start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < iCount ; i++)
+    {
+        iExtract(iReports[i % NB_REPORTS], &data);
+        *ioChecksum += data.accel[i % 3] + data.gyro[i % 3];
+    }
+    return (double)(hostNanoseconds() - start) / iCount;
+}
+
+static double measureStore(const struct reportDescriptor* iDesc, unsigned char iReports[NB_REPORTS][256], unsigned int iCount)
+{
+    struct dsDevice* device = &devices[0];
+    device->counter = device->touchCounter = 0;
+    device->ring->counter = device->ring->touchCounter = 0;
+    device->clock.valid = 0;
+    calibrationReset(&device->calibration, NULL);
+    device->type = iDesc->type;
+    device->ring->type = iDesc->type;
+    updatePrimaryDevice();
+
+    unsigned long long start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < iCount ; i++)
+        storeReport(device, iReports[i % NB_REPORTS], i * REPORT_PERIOD_US);
+    double duration = (double)(hostNanoseconds() - start) / iCount;
+
+    HOST_CHECK(iCount == device->counter);
+    return duration;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000000;
+    HOST_CHECK(count > 0);
+
+    hostSetRoot(NULL);
+    sharedOpen();
+
+    static unsigned char reports[NB_REPORTS][256];
+    int checksum = 0;
+
+    printf("%u reports per controller\n", count);
+    for (int c = 0 ; c < sizeof(cases)/sizeof(cases[0]) ; c++)
+    {
+        const struct decodeCase* test = &cases[c];
+        makeReports(test->desc, reports);
+
+        // Descriptors must give the values of the former decoding
+        for (int i = 0 ; test->former && i < NB_REPORTS ; i++)
+        {
+            struct accelGyroData decoded;
+            struct accelGyroData expected;
+            test->extract(reports[i], &decoded);
+            test->former(reports[i], &expected);
+            HOST_CHECK(0 == memcmp(decoded.accel, expected.accel, sizeof(decoded.accel)));
+            HOST_CHECK(0 == memcmp(decoded.gyro, expected.gyro, sizeof(decoded.gyro)));
+        }
+
+        if (DS_DEVICE_DS4 == test->desc->type)
+            checkTouch(reports);
+
+        printf("%s\n", test->name);
+        printf("  descriptor decoding  %6.2f ns/report\n", measureExtract(test->extract, reports, count, &checksum));
+        if (NULL != test->former)
+            printf("  former decoding      %6.2f ns/report\n", measureExtract(test->former, reports, count, &checksum));
+        printf("  storeReport          %6.2f ns/report\n", measureStore(test->desc, reports, count));
+    }
+
+    printf("(checksum %d)\n", checksum);
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Hook benchmark: synthetic DS3 and DS4 reports are pushed through the kernel plugin
+ * Bluetooth hooks at 1 kHz of system time, each followed by a sceMotionGetState call.
+ * Prints the cost of the Bluetooth hooks and the report to SceMotionState latency.
+ * Usage: bench_hooks [reports per controller]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "../DSMotionLibrary.h"
+
+#define SONY_VID  0x054C
+#define DS3_PID   0x0268
+#define DS4_PID   0x05C4
+
+#define REPORT_SIZE 64
+#define REPORT_PERIOD_US 1000
+
+// Offsets of the sensor fields (see ds3_input_report and ds4_input_report)
+#define DS3_ACCEL_OFFSET 41
+#define DS3_GYRO_OFFSET 47
+#define DS4_COUNTER_OFFSET 10
+#define DS4_GYRO_OFFSET 13  // Fields named accel_* in ds4_input_report
+#define DS4_ACCEL_OFFSET 19 // Fields named gyro_* (reversed order)
+
+static void writeShort(unsigned char* oReport, int iOffset, int iValue)
+{
+    oReport[iOffset] = iValue & 0xFF;
+    oReport[iOffset+1] = (iValue >> 8) & 0xFF;
+}
+
+// Still controller with the gravity on one axis, and some noise so that each report differs
+static void makeReport(int iDS3, unsigned int iIndex, unsigned char* oReport)
+{
+    memset(oReport, 0, REPORT_SIZE);
+    int noise = (iIndex * 7919) % 17 - 8;
+
+    if (iDS3)
+    {
+        oReport[0] = 0x01;
+        writeShort(oReport, DS3_ACCEL_OFFSET, 512 + noise);
+        writeShort(oReport, DS3_ACCEL_OFFSET+2, 512 - 113);
+        writeShort(oReport, DS3_ACCEL_OFFSET+4, 512 + noise/2);
+        writeShort(oReport, DS3_GYRO_OFFSET, 0x15FF + noise);
+    }
+    else
+    {
+        oReport[0] = 0x11;
+        // Controller clock in 16/3 us ticks
+        writeShort(oReport, DS4_COUNTER_OFFSET, (iIndex * REPORT_PERIOD_US * 3 / 16) & 0xFFFF);
+        writeShort(oReport, DS4_ACCEL_OFFSET, noise);
+        writeShort(oReport, DS4_ACCEL_OFFSET+2, 0x2000 + noise);
+        writeShort(oReport, DS4_ACCEL_OFFSET+4, -noise);
+        writeShort(oReport, DS4_GYRO_OFFSET, 100 + noise);
+        writeShort(oReport, DS4_GYRO_OFFSET+2, noise);
+        writeShort(oReport, DS4_GYRO_OFFSET+4, -noise);
+    }
+}
+
+static int compareDurations(const void* iLeft, const void* iRight)
+{
+    unsigned long long left = *(const unsigned long long*)iLeft;
+    unsigned long long right = *(const unsigned long long*)iRight;
+    return (left > right) - (left < right);
+}
+
+static void printDurations(const char* iName, unsigned long long* ioDurations, unsigned int iCount)
+{
+    qsort(ioDurations, iCount, sizeof(unsigned long long), compareDurations);
+    printf("%-24s p50 %6llu ns  p90 %6llu ns  p99 %6llu ns  max %7llu ns\n", iName,
+           ioDurations[iCount/2], ioDurations[iCount*9/10], ioDurations[iCount*99/100], ioDurations[iCount-1]);
+}
+
+static void runController(const char* iName, int iDS3, unsigned int iMac0, unsigned int iCount)
+{
+    unsigned long long* hookDurations = malloc(iCount * sizeof(unsigned long long));
+    unsigned long long* stateDurations = malloc(iCount * sizeof(unsigned long long));
+    HOST_CHECK(NULL != hookDurations && NULL != stateDurations);
+
+    HOST_CHECK(hostBtConnect(iMac0, 0) >= 0);
+
+    unsigned char report[REPORT_SIZE];
+    SceMotionState state;
+    unsigned int firstCounter = 0;
+
+    for (unsigned int i = 0 ; i < iCount ; i++)
+    {
+        makeReport(iDS3, i, report);
+        hostAdvanceTime(REPORT_PERIOD_US);
+
+        unsigned long long start = hostNanoseconds();
+        HOST_CHECK(hostBtReport(iMac0, 0, report, sizeof(report)) >= 0);
+        unsigned long long received = hostNanoseconds();
+        HOST_CHECK(hostMotionGetState(&state) >= 0);
+        unsigned long long end = hostNanoseconds();
+
+        hookDurations[i] = received - start;
+        stateDurations[i] = end - start;
+
+        if (0 == i)
+            firstCounter = dsGetCurrentCounter();
+    }
+
+    // Each report must have been accepted, and the last state must show the gravity (DS3 values are not scaled to 1G)
+    HOST_CHECK(dsGetCurrentCounter() - firstCounter == iCount - 1);
+    float norm = state.acceleration.x*state.acceleration.x + state.acceleration.y*state.acceleration.y + state.acceleration.z*state.acceleration.z;
+    HOST_CHECK(iDS3 || (norm > 0.8f && norm < 1.2f));
+    HOST_CHECK(iDS3 || (0.f == state.basicOrientation.x && 0.f == state.basicOrientation.y && 1.f == state.basicOrientation.z));
+
+    HOST_CHECK(hostBtDisconnect(iMac0, 0) >= 0);
+
+    printf("%s, %u reports\n", iName, iCount);
+    printDurations("  bluetooth hooks", hookDurations, iCount);
+    printDurations("  report to state", stateDurations, iCount);
+
+    free(hookDurations);
+    free(stateDurations);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+    HOST_CHECK(count >= 100);
+
+    hostSetRoot(NULL);
+    hostSetTime(1000000);
+    hostBtSetVidPid(0xDD0003, 0, SONY_VID, DS3_PID);
+    hostBtSetVidPid(0xDD0004, 0, SONY_VID, DS4_PID);
+
+    HOST_CHECK(dsKernelModuleStart(0, NULL) == SCE_KERNEL_START_SUCCESS);
+    HOST_CHECK(dsUserModuleStart(0, NULL) == SCE_KERNEL_START_SUCCESS);
+    HOST_CHECK(hostMotionStartSampling() >= 0);
+
+    runController("DS3", 1, 0xDD0003, count);
+    runController("DS4", 0, 0xDD0004, count);
+
+    dsUserModuleStop(0, NULL);
+    dsKernelModuleStop(0, NULL);
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Math benchmark: each fastmath.h function against libm, maximum error over its input range
+ * (compared with the double precision result) and ns/call of both.
+ * Usage: bench_math [calls per function]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+#include "../user/fastmath.h"
+
+#define NB_INPUTS 4096
+
+typedef float (*floatFunc)(float x);
+typedef double (*referenceFunc)(double x);
+
+static float fastSqrtCall(float x) { return fastSqrt(x); }
+static float fastInvSqrtCall(float x) { return fastInvSqrt(x); }
+static float fastSinCall(float x) { return fastSin(x); }
+static float fastCosCall(float x) { return fastCos(x); }
+static float fastAtanCall(float x) { return fastAtan(x); }
+static float fastAcosCall(float x) { return fastAcos(x); }
+static float fastAtan2Call(float x) { return fastAtan2(x, 1.f - x); } // Every quadrant over [-2, 2]
+
+static float libmSqrt(float x) { return sqrtf(x); }
+static float libmInvSqrt(float x) { return 1.f / sqrtf(x); }
+static float libmSin(float x) { return sinf(x); }
+static float libmCos(float x) { return cosf(x); }
+static float libmAtan(float x) { return atanf(x); }
+static float libmAcos(float x) { return acosf(x); }
+static float libmAtan2(float x) { return atan2f(x, 1.f - x); }
+
+static double refInvSqrt(double x) { return 1. / sqrt(x); }
+static double refAtan2(double x) { return atan2(x, 1. - (float)x); }
+
+struct mathCase
+{
+    const char* name;
+    floatFunc fast;
+    floatFunc libm;
+    referenceFunc reference;
+    float min;
+    float max;
+    int relative;   // Relative error for functions without bounded output
+    double maxError; // Checked, a few float epsilons
+};
+
+static const struct mathCase cases[] =
+{
+    {"sqrt",    fastSqrtCall,    libmSqrt,    sqrt,       1e-6f, 16.f,          1, 1e-6},
+    {"invsqrt", fastInvSqrtCall, libmInvSqrt, refInvSqrt, 1e-6f, 16.f,          1, 1e-6},
+    {"sin",     fastSinCall,     libmSin,     sin,        -4*M_PI, 4*M_PI,      0, 1e-6},
+    {"cos",     fastCosCall,     libmCos,     cos,        -4*M_PI, 4*M_PI,      0, 1e-6},
+    {"atan",    fastAtanCall,    libmAtan,    atan,       -100.f, 100.f,        0, 1e-6},
+    {"atan2",   fastAtan2Call,   libmAtan2,   refAtan2,   -2.f, 2.f,            0, 1e-6},
+    {"acos",    fastAcosCall,    libmAcos,    acos,       -1.f, 1.f,            0, 1e-6},
+};
+
+static double measureError(const struct mathCase* iCase, floatFunc iFunc, unsigned int iSteps)
+{
+    double maxError = 0.;
+    for (unsigned int i = 0 ; i <= iSteps ; i++)
+    {
+        float x = iCase->min + (iCase->max - iCase->min) * i / iSteps;
+        double expected = iCase->reference(x);
+        double error = fabs(iFunc(x) - expected);
+        if (iCase->relative)
+            error /= fabs(expected);
+        if (error > maxError)
+            maxError = error;
+    }
+    return maxError;
+}
+
+static double measureSpeed(floatFunc iFunc, const float* iInputs, unsigned int iCalls, float* ioChecksum)
+{
+    float sum = 0.f;
+    unsigned long long start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < iCalls ; i++)
+        sum += iFunc(iInputs[i % NB_INPUTS]);
+    double duration = (double)(hostNanoseconds() - start) / iCalls;
+
+    *ioChecksum += sum;
+    return duration;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int calls = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000000;
+    HOST_CHECK(calls > 0);
+
+    static float inputs[NB_INPUTS];
+    float checksum = 0.f;
+
+    printf("%-8s %12s %12s %10s %10s\n", "", "fast error", "libm error", "fast ns", "libm ns");
+    for (int c = 0 ; c < sizeof(cases)/sizeof(cases[0]) ; c++)
+    {
+        const struct mathCase* test = &cases[c];
+
+        double fastError = measureError(test, test->fast, 1000000);
+        double libmError = measureError(test, test->libm, 1000000);
+
+        unsigned int seed = 12345;
+        for (int i = 0 ; i < NB_INPUTS ; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            inputs[i] = test->min + (test->max - test->min) * (seed >> 8) / (float)(1 << 24);
+        }
+
+        double fastDuration = measureSpeed(test->fast, inputs, calls, &checksum);
+        double libmDuration = measureSpeed(test->libm, inputs, calls, &checksum);
+
+        printf("%-8s %12.3g %12.3g %10.2f %10.2f%s\n", test->name, fastError, libmError, fastDuration, libmDuration,
+               test->relative ? "  (relative error)" : "");
+        HOST_CHECK(fastError < test->maxError);
+    }
+
+    printf("(checksum %g)\n", checksum);
+    return 0;
+}
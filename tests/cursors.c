@@ -0,0 +1,69 @@
+/*
+ * Read cursors: after a reconnection, a process gets the samples of the new connection from
+ * its first one, even when the new connection already passed the counter it had read.
+ * Samples overwritten before a reader got them are counted as unread overwrites.
+ * Usage: cursors
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define MAC 0xC50000
+#define SAMPLE_PERIOD_US 4000
+
+// Samples tagged with their connection
+static void writeSamples(struct dsDevice* ioDevice, unsigned int iCount, signed short iConnection)
+{
+    for (unsigned int i = 0 ; i < iCount ; i++)
+    {
+        struct accelGyroData data = {{iConnection, 0, DS_ACCEL_ONE_G}, {0, 0, 0}, (ioDevice->counter + 1) * SAMPLE_PERIOD_US, 0};
+        writeSample(ioDevice, &ds4Descriptor.scale, &data);
+    }
+}
+
+static void checkRead(unsigned int iCount, signed short iConnection)
+{
+    struct accelGyroData data[64];
+    unsigned int lost = 0xFFFFFFFF;
+    HOST_CHECK(iCount == dsGetDeviceNewAccelGyro(0, 64, data, &lost));
+    HOST_CHECK(0 == lost);
+    for (unsigned int i = 0 ; i < iCount ; i++)
+        HOST_CHECK(i+1 == data[i].counter && iConnection == data[i].accel[0]);
+}
+
+int main(int argc, char** argv)
+{
+    hostSetRoot(NULL);
+    sharedOpen();
+    hostSetProcessId(0x40010031);
+
+    hostBtSetVidPid(MAC, 0, SONY_VID, DS4_PID);
+    connectDevice(NULL, MAC, 0);
+    struct dsDevice* device = &devices[0];
+    HOST_CHECK(DS_DEVICE_DS4 == device->type);
+
+    writeSamples(device, 10, 1);
+    checkRead(10, 1);
+
+    // New connection goes past counter 10 before the next read
+    connectDevice(device, MAC, 0);
+    writeSamples(device, 20, 2);
+    checkRead(20, 2);
+
+    writeSamples(device, 5, 2);
+    struct accelGyroData data[64];
+    HOST_CHECK(5 == dsGetDeviceNewAccelGyro(0, 64, data, NULL) && 21 == data[0].counter);
+
+    // A reader late by more than the ring loses the oldest samples, counted in the stats
+    writeSamples(device, DS_HISTORY_SIZE + 3, 2);
+    unsigned int lost = 0;
+    HOST_CHECK(DS_HISTORY_SIZE > dsGetDeviceNewAccelGyro(0, 64, data, &lost) && 3 == lost);
+    struct dsStats readStats;
+    HOST_CHECK(0 == dsGetStats(&readStats) && 3 == readStats.unreadOverwrites);
+
+    printf("reconnection read from its first sample\n");
+    return 0;
+}
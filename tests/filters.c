@@ -0,0 +1,136 @@
+/*
+ * Per process filters: processes setting different filters each get their own output
+ * for the same samples, and a process without filter gets the default box filter.
+ * Also checks the online calibration follows the sensor scale of each controller type.
+ * Usage: filters
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define PROCESS_EMA     0x40010021
+#define PROCESS_BOX     0x40010022
+#define PROCESS_DEFAULT 0x40010023
+#define SAMPLE_PERIOD_US 4000
+#define STEP_VALUE 4096
+
+// Still controller, then a step on every axis
+static void writeSamples(struct dsDevice* ioDevice, unsigned int iCount, signed short iValue)
+{
+    for (unsigned int i = 0 ; i < iCount ; i++)
+    {
+        struct accelGyroData data;
+        for (int j = 0 ; j < 3 ; j++)
+        {
+            data.accel[j] = iValue;
+            data.gyro[j] = -iValue;
+        }
+        data.timestamp = (ioDevice->counter + 1) * SAMPLE_PERIOD_US;
+        data.counter = 0;
+        writeSample(ioDevice, &ds4Descriptor.scale, &data);
+    }
+}
+
+static signed short readFiltered(SceUID iPid)
+{
+    signed short accel[3];
+    signed short gyro[3];
+    hostSetProcessId(iPid);
+    HOST_CHECK(dsGetDeviceFilteredAccelGyro(0, accel, gyro) == devices[0].counter);
+    HOST_CHECK(accel[0] == accel[1] && accel[1] == accel[2]);
+    HOST_CHECK(gyro[0] == -accel[0]);
+    return accel[0];
+}
+
+static void setFilter(SceUID iPid, int iType, unsigned int iTimeConstantUS)
+{
+    struct dsFilterParams params = {iType, iTimeConstantUS, 1000, 0};
+    hostSetProcessId(iPid);
+    HOST_CHECK(0 == dsSetFilter(&params));
+}
+
+// Slow rotation around the DS3 gyroscope axis, gravity turning in the other two axes
+static void checkCalibrationDS3()
+{
+    struct calibrationState state;
+    calibrationReset(&state, NULL);
+
+    for (int i = 0 ; i < 2000 ; i++)
+    {
+        float angle = i * 0.002f;
+        struct accelGyroData data = {{0, 0, 0}, {0, 30, 0}, i * SAMPLE_PERIOD_US, 0};
+        data.accel[0] = (signed short)(DS_ACCEL_ONE_G_DS3 * cosf(angle));
+        data.accel[2] = (signed short)(DS_ACCEL_ONE_G_DS3 * sinf(angle));
+        HOST_CHECK(0 == calibrationUpdate(&state, &ds3Descriptor.scale, &data));
+    }
+    HOST_CHECK(!state.values.gyroValid && 0 == state.values.gyroBias[1]);
+}
+
+// Still DS4 with a gyroscope bias and gravity on one axis
+static void checkCalibrationDS4()
+{
+    struct calibrationState state;
+    calibrationReset(&state, NULL);
+
+    for (int i = 0 ; i < CALIB_STILL_SAMPLES ; i++)
+    {
+        struct accelGyroData data = {{0, DS_ACCEL_ONE_G + (i % 3), 0}, {50, -20, 10}, i * SAMPLE_PERIOD_US, 0};
+        HOST_CHECK((CALIB_STILL_SAMPLES-1 == i) == calibrationUpdate(&state, &ds4Descriptor.scale, &data));
+    }
+    HOST_CHECK(state.values.gyroValid);
+    HOST_CHECK(50 == state.values.gyroBias[0] && -20 == state.values.gyroBias[1] && 10 == state.values.gyroBias[2]);
+    HOST_CHECK(0 != state.values.accelPlus[1] && 0 == state.values.accelMinus[1]);
+}
+
+int main(int argc, char** argv)
+{
+    checkCalibrationDS3();
+    checkCalibrationDS4();
+
+    hostSetRoot(NULL);
+    sharedOpen();
+
+    struct dsDevice* device = &devices[0];
+    device->type = DS_DEVICE_DS4;
+    device->ring->type = DS_DEVICE_DS4;
+    updatePrimaryDevice();
+
+    setFilter(PROCESS_EMA, DS_FILTER_EMA, 40000);
+    setFilter(PROCESS_BOX, DS_FILTER_BOX, 20000);
+
+    writeSamples(device, 100, 0);
+    writeSamples(device, 3, STEP_VALUE);
+
+    // 3 samples after the step: EMA of 10 samples time constant is on its way,
+    // box of 20ms (6 samples with both ends) is at 3/6 and the default box of 100ms at 3/26
+    signed short ema = readFiltered(PROCESS_EMA);
+    signed short box = readFiltered(PROCESS_BOX);
+    signed short defaultBox = readFiltered(PROCESS_DEFAULT);
+    printf("3 samples after the step: ema %d, box %d, default %d\n", ema, box, defaultBox);
+
+    HOST_CHECK(ema > STEP_VALUE/5 && ema < STEP_VALUE/2);
+    HOST_CHECK(box == STEP_VALUE*3/6);
+    HOST_CHECK(defaultBox == STEP_VALUE*3/26);
+
+    // A new setting starts over from the next sample, other processes keep their state
+    setFilter(PROCESS_BOX, DS_FILTER_EMA, 1000000);
+    writeSamples(device, 1, STEP_VALUE);
+    HOST_CHECK(readFiltered(PROCESS_BOX) == STEP_VALUE);
+    HOST_CHECK(readFiltered(PROCESS_EMA) > ema);
+
+    // Every slot taken: the least recently set one goes to the new process
+    for (int i = 0 ; i < DS_MAX_FILTERS ; i++)
+        setFilter(0x40010100 + i, DS_FILTER_CRITICALLY_DAMPED, 50000);
+    HOST_CHECK(NULL == dsFindFilter(sharedMemory, PROCESS_EMA));
+    HOST_CHECK(NULL == dsFindFilter(sharedMemory, PROCESS_BOX));
+    HOST_CHECK(NULL != dsFindFilter(sharedMemory, 0x40010100));
+    setFilter(0x40010200, DS_FILTER_EMA, 50000);
+    HOST_CHECK(NULL == dsFindFilter(sharedMemory, 0x40010100));
+    HOST_CHECK(NULL != dsFindFilter(sharedMemory, 0x40010101));
+
+    return 0;
+}
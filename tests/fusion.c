@@ -0,0 +1,310 @@
+/*
+ * Fixed point fusion test: the kernel plugin Q30 Mahony filter against the same filter in float
+ * (the user plugin one), both fed with the samples of a simulated DS4 moving on every axis.
+ * Prints their largest difference (and tilt error against the simulated orientation) and the cost of an update.
+ * Also checks both follow a DS3 tilt they can only see with the accelerometer.
+ * Usage: fusion [updates]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define SAMPLE_PERIOD_US 4000
+#define NB_SAMPLES 5000 // 20 seconds
+#define NB_DS3_SAMPLES 2500
+#define SIM_STEPS 16    // Simulation steps by sample
+#define ONE_G 0x2000
+#define GYRO_SCALE 2607.6f
+
+// Float filter, same as the user plugin one
+#define REF_KP 1.f
+#define REF_KI 0.05f
+
+struct quat
+{
+    float x, y, z, w;
+};
+
+static void quatIntegrate(struct quat* ioQuat, const float iGyro[3], float iDeltaTime)
+{
+    float halfDt = 0.5f * iDeltaTime;
+    struct quat q = *ioQuat;
+    ioQuat->w += halfDt * (-q.x*iGyro[0] - q.y*iGyro[1] - q.z*iGyro[2]);
+    ioQuat->x += halfDt * ( q.w*iGyro[0] + q.y*iGyro[2] - q.z*iGyro[1]);
+    ioQuat->y += halfDt * ( q.w*iGyro[1] - q.x*iGyro[2] + q.z*iGyro[0]);
+    ioQuat->z += halfDt * ( q.w*iGyro[2] + q.x*iGyro[1] - q.y*iGyro[0]);
+
+    float invNorm = 1.f / sqrtf(ioQuat->w*ioQuat->w + ioQuat->x*ioQuat->x + ioQuat->y*ioQuat->y + ioQuat->z*ioQuat->z);
+    ioQuat->w *= invNorm;
+    ioQuat->x *= invNorm;
+    ioQuat->y *= invNorm;
+    ioQuat->z *= invNorm;
+}
+
+// Resting gravity {0, -1, 0} in device frame
+static void quatGravity(const struct quat* iQuat, float oGravity[3])
+{
+    oGravity[0] = -2.f * (iQuat->x*iQuat->y + iQuat->w*iQuat->z);
+    oGravity[1] = -(iQuat->w*iQuat->w - iQuat->x*iQuat->x + iQuat->y*iQuat->y - iQuat->z*iQuat->z);
+    oGravity[2] = -2.f * (iQuat->y*iQuat->z - iQuat->w*iQuat->x);
+}
+
+// From the distance between both quaternions: acos of their dot product has no resolution at small angles
+static float quatAngle(const struct quat* iQuat1, const struct quat* iQuat2)
+{
+    double sign = (iQuat1->x*iQuat2->x + iQuat1->y*iQuat2->y + iQuat1->z*iQuat2->z + iQuat1->w*iQuat2->w < 0.f) ? -1. : 1.;
+    double d[4] = {iQuat1->x - sign*iQuat2->x, iQuat1->y - sign*iQuat2->y, iQuat1->z - sign*iQuat2->z, iQuat1->w - sign*iQuat2->w};
+    double distance = sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2] + d[3]*d[3]);
+    return 4. * asin((distance > 2.) ? 1. : distance / 2.);
+}
+
+// Tilt error only: the heading is not observed
+static float gravityAngle(const struct quat* iQuat1, const struct quat* iQuat2)
+{
+    float g1[3];
+    float g2[3];
+    quatGravity(iQuat1, g1);
+    quatGravity(iQuat2, g2);
+    double cross[3] = {(double)g1[1]*g2[2] - (double)g1[2]*g2[1], (double)g1[2]*g2[0] - (double)g1[0]*g2[2], (double)g1[0]*g2[1] - (double)g1[1]*g2[0]};
+    double dot = (double)g1[0]*g2[0] + (double)g1[1]*g2[1] + (double)g1[2]*g2[2];
+    return atan2(sqrt(cross[0]*cross[0] + cross[1]*cross[1] + cross[2]*cross[2]), dot);
+}
+
+struct referenceFilter
+{
+    struct quat quat;
+    float gyroBias[3];
+    int ready;
+};
+
+// Shortest rotation from the resting gravity to the measured one
+static void referenceAlign(struct referenceFilter* ioFilter, const float iAccel[3])
+{
+    float norm = sqrtf(iAccel[0]*iAccel[0] + iAccel[1]*iAccel[1] + iAccel[2]*iAccel[2]);
+    float a[3] = {iAccel[0] / norm, iAccel[1] / norm, iAccel[2] / norm};
+
+    float angle = acosf(-a[1]);
+    float axis[3] = {a[2], 0.f, -a[0]};
+    float axisNorm = sqrtf(axis[0]*axis[0] + axis[2]*axis[2]);
+    float s = sinf(0.5f * angle) / axisNorm;
+
+    ioFilter->quat.x = axis[0] * s;
+    ioFilter->quat.y = 0.f;
+    ioFilter->quat.z = axis[2] * s;
+    ioFilter->quat.w = cosf(0.5f * angle);
+    ioFilter->ready = 1;
+}
+
+static void referenceUpdate(struct referenceFilter* ioFilter, const float iAccel[3], const float iGyro[3], float iOneG, float iDeltaTime)
+{
+    float gyro[3] = {iGyro[0], iGyro[1], iGyro[2]};
+
+    float accelSqNorm = iAccel[0]*iAccel[0] + iAccel[1]*iAccel[1] + iAccel[2]*iAccel[2];
+    if (accelSqNorm > 0.5f * iOneG * iOneG && accelSqNorm < 1.5f * iOneG * iOneG)
+    {
+        float invNorm = 1.f / sqrtf(accelSqNorm);
+        float a[3] = {iAccel[0] * invNorm, iAccel[1] * invNorm, iAccel[2] * invNorm};
+
+        float v[3];
+        quatGravity(&ioFilter->quat, v);
+
+        float e[3] = {a[1]*v[2] - a[2]*v[1], a[2]*v[0] - a[0]*v[2], a[0]*v[1] - a[1]*v[0]};
+        for (int i = 0 ; i < 3 ; i++)
+        {
+            ioFilter->gyroBias[i] += REF_KI * e[i] * iDeltaTime;
+            gyro[i] += REF_KP * e[i] + ioFilter->gyroBias[i];
+        }
+    }
+
+    quatIntegrate(&ioFilter->quat, gyro, iDeltaTime);
+}
+
+// Angular velocity in SceMotion axes (rad/s) at time iTime
+static void simulatedGyro(float iTime, float oGyro[3])
+{
+    oGyro[0] = 0.8f * sinf(2.f * M_PI * 0.3f * iTime);
+    oGyro[1] = 1.2f * cosf(2.f * M_PI * 0.2f * iTime);
+    oGyro[2] = 0.5f * sinf(2.f * M_PI * 0.5f * iTime + 1.f);
+}
+
+// Raw sample from values in SceMotion axes (inverse of fusionAxes), iOneG is the controller 1G
+static void rawSample(const float iAccel[3], const float iGyro[3], int iOneG, unsigned int iTimestamp, struct accelGyroData* oData)
+{
+    oData->accel[0] = (signed short)lrintf(iAccel[1] * iOneG);
+    oData->accel[1] = (signed short)lrintf(-iAccel[2] * iOneG);
+    oData->accel[2] = (signed short)lrintf(-iAccel[0] * iOneG);
+
+    oData->gyro[0] = (signed short)lrintf(iGyro[0] * GYRO_SCALE);
+    oData->gyro[1] = (signed short)lrintf(iGyro[2] * GYRO_SCALE);
+    oData->gyro[2] = (signed short)lrintf(-iGyro[1] * GYRO_SCALE);
+
+    oData->timestamp = iTimestamp;
+    oData->counter = 0;
+}
+
+// Values in SceMotion axes seen by both filters, from the raw sample
+static void sampleValues(const struct accelGyroData* iData, float oAccel[3], float oGyro[3])
+{
+    oAccel[0] = -(float)iData->accel[2] / ONE_G;
+    oAccel[1] = (float)iData->accel[0] / ONE_G;
+    oAccel[2] = -(float)iData->accel[1] / ONE_G;
+
+    oGyro[0] = (float)iData->gyro[0] / GYRO_SCALE;
+    oGyro[1] = -(float)iData->gyro[2] / GYRO_SCALE;
+    oGyro[2] = (float)iData->gyro[1] / GYRO_SCALE;
+}
+
+static struct quat fromFixed(const struct dsQuaternion* iQuat)
+{
+    struct quat res = {(float)iQuat->x / DS_ORIENTATION_ONE, (float)iQuat->y / DS_ORIENTATION_ONE,
+                       (float)iQuat->z / DS_ORIENTATION_ONE, (float)iQuat->w / DS_ORIENTATION_ONE};
+    return res;
+}
+
+static struct accelGyroData samples[NB_SAMPLES];
+static struct quat truths[NB_SAMPLES];
+
+static void simulate()
+{
+    struct quat truth = {0.3f, 0.1f, -0.2f, 0.93f};
+    quatIntegrate(&truth, (const float[3]){0.f, 0.f, 0.f}, 0.f);
+
+    for (int i = 0 ; i < NB_SAMPLES ; i++)
+    {
+        for (int s = 0 ; s < SIM_STEPS ; s++)
+        {
+            float gyro[3];
+            simulatedGyro((i * SIM_STEPS + s) * (SAMPLE_PERIOD_US * 1e-6f / SIM_STEPS), gyro);
+            quatIntegrate(&truth, gyro, (0 == i) ? 0.f : SAMPLE_PERIOD_US * 1e-6f / SIM_STEPS);
+        }
+
+        float accel[3];
+        float gyro[3];
+        quatGravity(&truth, accel);
+        simulatedGyro(i * SAMPLE_PERIOD_US * 1e-6f, gyro);
+        rawSample(accel, gyro, DS_ACCEL_ONE_G, 1000000 + i * SAMPLE_PERIOD_US, &samples[i]);
+        truths[i] = truth;
+    }
+}
+
+// DS3 still, then turned around the x axis which its gyroscope doesn't measure: gravity correction alone must follow
+static void checkDS3Tilt()
+{
+    struct fusionState state;
+    memset(&state, 0, sizeof(state));
+    struct referenceFilter reference;
+    memset(&reference, 0, sizeof(reference));
+
+    const float angle = 0.5f;
+    struct quat tilted = {sinf(0.5f * angle), 0.f, 0.f, cosf(0.5f * angle)};
+    float accel[3];
+    quatGravity(&tilted, accel);
+    const float gyro[3] = {0.f, 0.f, 0.f};
+
+    // Start slightly off the resting position: the float alignment has no axis for it
+    struct quat start = {0.f, 0.f, sinf(0.05f), cosf(0.05f)};
+    float startAccel[3];
+    quatGravity(&start, startAccel);
+
+    struct accelGyroData still;
+    struct accelGyroData tilt;
+    rawSample(startAccel, gyro, DS_ACCEL_ONE_G_DS3, 0, &still);
+    rawSample(accel, gyro, DS_ACCEL_ONE_G_DS3, 0, &tilt);
+
+    struct dsQuaternion fixed;
+    for (int i = 0 ; i < NB_DS3_SAMPLES ; i++)
+    {
+        struct accelGyroData* data = (i < NB_DS3_SAMPLES/10) ? &still : &tilt;
+        data->timestamp = 1000000 + i * SAMPLE_PERIOD_US;
+        fusionSample(&state, 0 == i, &ds3Descriptor.scale, data, &fixed);
+
+        float values[3];
+        float gyroValues[3];
+        sampleValues(data, values, gyroValues);
+        if (reference.ready)
+            referenceUpdate(&reference, values, gyroValues, (float)DS_ACCEL_ONE_G_DS3 / ONE_G, SAMPLE_PERIOD_US * 1e-6f);
+        else
+            referenceAlign(&reference, values);
+    }
+
+    // Measured gravity is rounded to 1/28 G
+    struct quat fixedQuat = fromFixed(&fixed);
+    float fixedTilt = gravityAngle(&fixedQuat, &tilted);
+    float floatTilt = gravityAngle(&reference.quat, &tilted);
+    printf("DS3 tilt error after %d ms: Q30 %.2e rad, float %.2e rad\n", NB_DS3_SAMPLES*9/10 * SAMPLE_PERIOD_US / 1000, fixedTilt, floatTilt);
+    HOST_CHECK(fixedTilt < 5e-2f);
+    HOST_CHECK(floatTilt < 5e-2f);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int updates = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000000;
+    HOST_CHECK(updates > 0);
+
+    simulate();
+
+    struct fusionState state;
+    memset(&state, 0, sizeof(state));
+    struct referenceFilter reference;
+    memset(&reference, 0, sizeof(reference));
+
+    float maxDifference = 0.f;
+    float maxMatrixDifference = 0.f;
+    float maxFixedDrift = 0.f;
+    float maxFloatDrift = 0.f;
+
+    for (int i = 0 ; i < NB_SAMPLES ; i++)
+    {
+        struct dsQuaternion fixed;
+        fusionSample(&state, 0 == i, &ds4Descriptor.scale, &samples[i], &fixed);
+
+        float accel[3];
+        float gyro[3];
+        sampleValues(&samples[i], accel, gyro);
+        if (reference.ready)
+            referenceUpdate(&reference, accel, gyro, 1.f, SAMPLE_PERIOD_US * 1e-6f);
+        else
+            referenceAlign(&reference, accel);
+
+        struct quat fixedQuat = fromFixed(&fixed);
+        maxDifference = fmaxf(maxDifference, quatAngle(&fixedQuat, &reference.quat));
+        maxFixedDrift = fmaxf(maxFixedDrift, gravityAngle(&fixedQuat, &truths[i]));
+        maxFloatDrift = fmaxf(maxFloatDrift, gravityAngle(&reference.quat, &truths[i]));
+
+        // Matrix second row is the resting gravity direction, negated
+        int matrix[9];
+        fusionMatrix(&fixed, matrix);
+        float gravity[3];
+        quatGravity(&reference.quat, gravity);
+        for (int j = 0 ; j < 3 ; j++)
+            maxMatrixDifference = fmaxf(maxMatrixDifference, fabsf((float)matrix[3+j] / DS_ORIENTATION_ONE + gravity[j]));
+    }
+
+    printf("Q30 against float: largest difference %.2e rad (orientation), %.2e (matrix)\n", maxDifference, maxMatrixDifference);
+    printf("tilt error against the simulated orientation: Q30 %.2e rad, float %.2e rad\n", maxFixedDrift, maxFloatDrift);
+
+    // Both filters get the same samples: only rounding can set them apart
+    HOST_CHECK(maxDifference < 1e-4f);
+    HOST_CHECK(maxMatrixDifference < 1e-4f);
+    HOST_CHECK(maxFixedDrift < 2e-2f);
+
+    checkDS3Tilt();
+
+    memset(&state, 0, sizeof(state));
+    struct dsQuaternion quat;
+    int checksum = 0;
+    unsigned long long start = hostNanoseconds();
+    for (unsigned int i = 0 ; i < updates ; i++)
+    {
+        fusionSample(&state, 0 == i, &ds4Descriptor.scale, &samples[i % NB_SAMPLES], &quat);
+        checksum += quat.w;
+    }
+    double duration = (double)(hostNanoseconds() - start) / updates;
+
+    printf("fusionSample: %.2f ns/update over %u updates (checksum %d)\n", duration, updates, checksum);
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * Identity cache file: entries of unknown controller types are dropped at load, the others
+ * can still be found even when a dropped entry was before them in their probe sequence.
+ * Usage: identity
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define UNKNOWN_TYPE 0x7F
+
+// Addresses whose hash gives the same cache index
+static void findCollisions(unsigned int* oMacs, int iCount)
+{
+    unsigned int index = identityHash(0xAA0000, 0) & IDENTITY_CACHE_MASK;
+    int found = 0;
+    for (unsigned int mac = 0xAA0000 ; found < iCount ; mac++)
+    {
+        if ((identityHash(mac, 0) & IDENTITY_CACHE_MASK) == index)
+            oMacs[found++] = mac;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    hostSetRoot(NULL);
+
+    unsigned int macs[3];
+    findCollisions(macs, 3);
+
+    // Unknown type first in the probe sequence, then a DS4 and another device
+    storeIdentity(macs[0], 0, UNKNOWN_TYPE);
+    storeIdentity(macs[1], 0, DS_DEVICE_DS4)->calibration.gyroBias[0] = 12;
+    storeIdentity(macs[2], 0, DS_DEVICE_NONE);
+    identitySave();
+
+    memset(identityCache, 0, sizeof(identityCache));
+    identityLoad();
+
+    HOST_CHECK(NULL == findIdentity(macs[0], 0));
+
+    struct deviceIdentity* ds4 = findIdentity(macs[1], 0);
+    HOST_CHECK(NULL != ds4 && DS_DEVICE_DS4 == ds4->type && 12 == ds4->calibration.gyroBias[0]);
+
+    struct deviceIdentity* other = findIdentity(macs[2], 0);
+    HOST_CHECK(NULL != other && DS_DEVICE_NONE == other->type);
+
+    printf("unknown type dropped, DS4 and other device kept\n");
+    return 0;
+}
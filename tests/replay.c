@@ -0,0 +1,268 @@
+/*
+ * Capture replay: feeds the reports of a capture file (see DSMotionCapture.h) back through
+ * the kernel plugin Bluetooth hooks, with the system clock set to their arrival time.
+ * Prints the hook cost, so that real sessions give repeatable measures.
+ * Usage: replay capture.bin
+ * Without file, a synthetic session is captured then replayed: the capture of the replay
+ * must be the same as the replayed one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <psp2/io/fcntl.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define REPLAY_MAC 0xCA0000
+
+struct replayStats
+{
+    unsigned int sessions;
+    unsigned int reports;
+    unsigned int capacity;
+    unsigned long long* durations;
+};
+
+static unsigned short getPid(unsigned char iReportId)
+{
+    switch (iReportId)
+    {
+    case 0x01: return 0x0268; // DS3
+    case 0x11: return 0x05C4; // DS4
+    case 0x31: return 0x0CE6; // DualSense
+    default:   return 0;
+    }
+}
+
+// Reports come much faster than on a console: a full capture buffer is left to the I/O thread before the next report
+static void waitCapture()
+{
+    while (captureFull[0] || captureFull[1])
+        usleep(100);
+}
+
+// Controllers of a session are disconnected before the next one starts
+static void endSession(unsigned int* ioConnected)
+{
+    for (int i = 0 ; i < 32 ; i++)
+    {
+        if (*ioConnected & (1u << i))
+            hostBtDisconnect(REPLAY_MAC + i, 0);
+    }
+    *ioConnected = 0;
+}
+
+static void addDuration(struct replayStats* ioStats, unsigned long long iDuration)
+{
+    if (ioStats->reports == ioStats->capacity)
+    {
+        ioStats->capacity = ioStats->capacity ? ioStats->capacity*2 : 4096;
+        ioStats->durations = realloc(ioStats->durations, ioStats->capacity * sizeof(unsigned long long));
+        HOST_CHECK(NULL != ioStats->durations);
+    }
+    ioStats->durations[ioStats->reports++] = iDuration;
+}
+
+// Returns 0 if the file isn't a valid capture
+static int replayFile(const char* iPath, struct replayStats* oStats)
+{
+    FILE* file = fopen(iPath, "rb");
+    if (NULL == file)
+    {
+        perror(iPath);
+        return 0;
+    }
+
+    memset(oStats, 0, sizeof(*oStats));
+
+    unsigned int connected = 0;
+    unsigned long long time = 0;
+    unsigned int lastTimestamp = 0;
+    int valid = 1;
+
+    struct dsCaptureRecord record;
+    unsigned char report[256];
+    while (valid && fread(&record, sizeof(record), 1, file) == 1)
+    {
+        // Session header: its "size" byte is the version
+        if (DS_CAPTURE_MAGIC == record.timestamp && record.size < DS_CAPTURE_MIN_REPORT_SIZE)
+        {
+            struct dsCaptureHeader header;
+            memcpy(&header, &record, sizeof(record));
+            valid = (fread((unsigned char*)&header + sizeof(record), sizeof(header) - sizeof(record), 1, file) == 1
+                     && DS_CAPTURE_VERSION == header.version);
+
+            endSession(&connected);
+            oStats->sessions++;
+            time = 0;
+            continue;
+        }
+
+        valid = (oStats->sessions > 0 && record.device < 32 && fread(report, record.size, 1, file) == 1);
+        if (!valid)
+            break;
+
+        // Timestamps are 32 bits wide: unwrapped with a signed delta within a session
+        time = (0 == time) ? record.timestamp : time + (int)(record.timestamp - lastTimestamp);
+        lastTimestamp = record.timestamp;
+        hostSetTime(time);
+
+        unsigned int mac = REPLAY_MAC + record.device;
+        if (!(connected & (1u << record.device)))
+        {
+            hostBtSetVidPid(mac, 0, SONY_VID, getPid(report[0]));
+            hostBtConnect(mac, 0);
+            connected |= 1u << record.device;
+        }
+
+        waitCapture();
+        unsigned long long start = hostNanoseconds();
+        hostBtReport(mac, 0, report, record.size);
+        addDuration(oStats, hostNanoseconds() - start);
+    }
+
+    endSession(&connected);
+    fclose(file);
+
+    if (!valid)
+        fprintf(stderr, "%s: not a version %d capture file\n", iPath, DS_CAPTURE_VERSION);
+    return valid;
+}
+
+static int compareDurations(const void* iLeft, const void* iRight)
+{
+    unsigned long long left = *(const unsigned long long*)iLeft;
+    unsigned long long right = *(const unsigned long long*)iRight;
+    return (left > right) - (left < right);
+}
+
+static void printStats(struct replayStats* ioStats)
+{
+    printf("%u sessions, %u reports\n", ioStats->sessions, ioStats->reports);
+    if (0 == ioStats->reports)
+        return;
+
+    unsigned long long* durations = ioStats->durations;
+    unsigned int count = ioStats->reports;
+    qsort(durations, count, sizeof(unsigned long long), compareDurations);
+    printf("bluetooth hooks  p50 %6llu ns  p90 %6llu ns  p99 %6llu ns  max %7llu ns\n",
+           durations[count/2], durations[count*9/10], durations[count*99/100], durations[count-1]);
+}
+
+// Empty capture file in a new root: the kernel plugin captures from its start
+static void newCaptureRoot(char* oCapturePath, unsigned int iSize)
+{
+    hostSetRoot(NULL);
+    hostPath(CAPTURE_PATH, oCapturePath, iSize);
+
+    SceUID fd = sceIoOpen(CAPTURE_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0666);
+    HOST_CHECK(fd >= 0);
+    sceIoClose(fd);
+}
+
+// Two boots with a DS4 then a DS3 and a DS4 together
+static void recordSession(void)
+{
+    static const unsigned short pids[2] = {0x05C4, 0x0268};
+
+    for (int boot = 0 ; boot < 2 ; boot++)
+    {
+        hostSetTime(5000000 + boot * 3000000);
+        HOST_CHECK(module_start(0, NULL) == SCE_KERNEL_START_SUCCESS);
+
+        int nbControllers = boot + 1;
+        for (int c = 0 ; c < nbControllers ; c++)
+        {
+            hostBtSetVidPid(0xD50000 + c, 0, SONY_VID, pids[c]);
+            hostBtConnect(0xD50000 + c, 0);
+        }
+
+        for (unsigned int i = 0 ; i < 3000 ; i++)
+        {
+            int c = i % nbControllers;
+            unsigned char report[64] = {0};
+            report[0] = (0 == c) ? 0x11 : 0x01;
+            for (int j = 1 ; j < sizeof(report) ; j++)
+                report[j] = (i * 31 + j * 7) & 0xFF;
+
+            hostAdvanceTime(1000 + (i * 13) % 700);
+            waitCapture();
+            HOST_CHECK(hostBtReport(0xD50000 + c, 0, report, sizeof(report)) >= 0);
+        }
+
+        for (int c = 0 ; c < nbControllers ; c++)
+            hostBtDisconnect(0xD50000 + c, 0);
+        module_stop(0, NULL);
+    }
+}
+
+static long readFile(const char* iPath, unsigned char** oData)
+{
+    FILE* file = fopen(iPath, "rb");
+    HOST_CHECK(NULL != file);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *oData = malloc(size);
+    HOST_CHECK(NULL != *oData);
+    HOST_CHECK(fread(*oData, 1, size, file) == (size_t)size);
+    fclose(file);
+    return size;
+}
+
+int main(int argc, char** argv)
+{
+    struct replayStats stats;
+
+    if (argc > 1)
+    {
+        hostSetRoot(NULL);
+        HOST_CHECK(module_start(0, NULL) == SCE_KERNEL_START_SUCCESS);
+        int valid = replayFile(argv[1], &stats);
+        module_stop(0, NULL);
+
+        printStats(&stats);
+        free(stats.durations);
+        return valid ? 0 : 1;
+    }
+
+    char recorded[512];
+    newCaptureRoot(recorded, sizeof(recorded));
+    recordSession();
+
+    // Replay in a single boot: its capture has one header, then the same records
+    char replayed[512];
+    newCaptureRoot(replayed, sizeof(replayed));
+    HOST_CHECK(module_start(0, NULL) == SCE_KERNEL_START_SUCCESS);
+    HOST_CHECK(replayFile(recorded, &stats));
+    module_stop(0, NULL);
+
+    printStats(&stats);
+    HOST_CHECK(2 == stats.sessions);
+    HOST_CHECK(6000 == stats.reports);
+
+    // Both captures must be complete
+    struct dsStats kernelStats;
+    dsGetStats(&kernelStats);
+    HOST_CHECK(0 == kernelStats.droppedCaptures);
+
+    unsigned char* recordedData;
+    unsigned char* replayedData;
+    long recordedSize = readFile(recorded, &recordedData);
+    long replayedSize = readFile(replayed, &replayedData);
+
+    unsigned int headerSize = sizeof(struct dsCaptureHeader);
+    unsigned int firstSessionSize = headerSize + 3000 * (sizeof(struct dsCaptureRecord) + 64);
+    HOST_CHECK(recordedSize == replayedSize + headerSize);
+    HOST_CHECK(0 == memcmp(recordedData, replayedData, firstSessionSize));
+    HOST_CHECK(0 == memcmp(recordedData + firstSessionSize + headerSize, replayedData + firstSessionSize, replayedSize - firstSessionSize));
+
+    free(recordedData);
+    free(replayedData);
+    free(stats.durations);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#ifndef DSMotionHost_H
+#define DSMotionHost_H
+
+/*
+ * Host side of the stand-in SDK: the plugin sources are built unchanged against the headers
+ * of this directory, and tests drive them through these functions.
+ * Hooks bound by the plugins are recorded by NID, stand-in originals are called by TAI_CONTINUE.
+ */
+
+#include <psp2/types.h>
+#include <psp2/motion.h>
+#include <psp2/touch.h>
+#include <psp2kern/bt.h>
+
+// Module entry points of both plugins, renamed so that they link in one program
+int dsKernelModuleStart(SceSize argc, const void *args);
+int dsKernelModuleStop(SceSize argc, const void *args);
+int dsUserModuleStart(SceSize argc, const void *args);
+int dsUserModuleStop(SceSize argc, const void *args);
+
+/*
+ * System clock: real time (microseconds since the first call) by default,
+ * or a manual clock once hostSetTime is called, for deterministic timestamps.
+ */
+void hostSetTime(unsigned long long iTimeUS);
+void hostAdvanceTime(unsigned int iDeltaUS);
+void hostUseRealTime(void);
+
+// Monotonic nanoseconds for measures, whatever the system clock mode
+unsigned long long hostNanoseconds(void);
+
+/*
+ * Files: "ux0:" paths are mapped under a host directory.
+ * hostSetRoot(NULL) creates an empty temporary directory, which is returned.
+ */
+const char* hostSetRoot(const char* iDirectory);
+const char* hostPath(const char* iVitaPath, char* oPath, unsigned int iSize);
+
+// Process seen by the calling thread (per thread, to simulate several processes)
+void hostSetProcessId(SceUID iPid);
+
+// Title ID given by sceAppMgrAppParamGetString
+void hostSetTitleId(const char* iTitleId);
+
+/*
+ * BlueTooth: each call goes through the ksceBtHidTransfer and ksceBtReadEvent hooks when bound,
+ * the stand-in originals only give back what is asked here.
+ */
+void hostBtSetVidPid(unsigned int iMac0, unsigned int iMac1, unsigned short iVid, unsigned short iPid);
+int hostBtEvent(unsigned char iId, unsigned int iMac0, unsigned int iMac1);
+int hostBtConnect(unsigned int iMac0, unsigned int iMac1);
+int hostBtDisconnect(unsigned int iMac0, unsigned int iMac1);
+int hostBtReport(unsigned int iMac0, unsigned int iMac1, const void* iReport, unsigned int iSize);
+
+// Hooked function bound by a plugin for this NID, NULL if none
+const void* hostGetHook(uint32_t iFuncNid);
+
+// Calls of the user functions hooked by the user plugin (stand-in originals if not hooked)
+int hostMotionStartSampling(void);
+int hostMotionGetState(SceMotionState* oState);
+int hostMotionGetSensorState(SceMotionSensorState* oStates, int iNumRecords);
+int hostTouchRead(SceUInt32 iPort, SceTouchData* oData, SceUInt32 iNbBufs);
+int hostTouchPeek(SceUInt32 iPort, SceTouchData* oData, SceUInt32 iNbBufs);
+
+// Test helpers: prints the failure and exits
+#define HOST_CHECK(cond) \
+    do { \
+        if (!(cond)) \
+            hostFail(__FILE__, __LINE__, #cond); \
+    } while (0)
+
+void hostFail(const char* iFile, int iLine, const char* iCondition);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _PSP2_APPMGR_H_
+#define _PSP2_APPMGR_H_
+
+#include <psp2/types.h>
+
+int sceAppMgrAppParamGetString(int pid, int param, char *string, SceSize length);
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef _PSP2_IO_STAT_H_
+#define _PSP2_IO_STAT_H_
+
+#include <psp2/types.h>
+
+typedef struct SceIoStat
+{
+    SceMode st_mode;
+    unsigned int st_attr;
+    SceOff st_size;
+    SceDateTime st_ctime;
+    SceDateTime st_atime;
+    SceDateTime st_mtime;
+    unsigned int st_private[6];
+} SceIoStat;
+
+int sceIoGetstat(const char *file, SceIoStat *stat);
+int sceIoMkdir(const char *dir, SceMode mode);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _PSP2_KERNEL_CLIB_H_
+#define _PSP2_KERNEL_CLIB_H_
+
+#include <psp2/types.h>
+
+#endif
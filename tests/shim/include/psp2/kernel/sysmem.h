@@ -0,0 +1,13 @@
+#ifndef _PSP2_KERNEL_SYSMEM_H_
+#define _PSP2_KERNEL_SYSMEM_H_
+
+#include <psp2/types.h>
+
+#define SCE_KERNEL_MEMBLOCK_TYPE_USER_RW 0x0C20D060
+
+SceUID sceKernelAllocMemBlock(const char *name, unsigned int type, SceSize size, void *opt);
+int sceKernelFreeMemBlock(SceUID uid);
+int sceKernelGetMemBlockBase(SceUID uid, void **base);
+SceUID sceKernelFindMemBlockByAddr(const void *addr, SceSize size);
+
+#endif
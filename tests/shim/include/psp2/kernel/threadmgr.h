@@ -0,0 +1,10 @@
+#ifndef _PSP2_KERNEL_THREADMGR_H_
+#define _PSP2_KERNEL_THREADMGR_H_
+
+#include <psp2/types.h>
+
+SceUInt32 sceKernelGetSystemTimeLow(void);
+SceUInt64 sceKernelGetSystemTimeWide(void);
+int sceKernelDelayThread(SceUInt delay);
+
+#endif
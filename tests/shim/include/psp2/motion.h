@@ -0,0 +1,37 @@
+#ifndef _PSP2_MOTION_H_
+#define _PSP2_MOTION_H_
+
+#include <psp2/types.h>
+
+typedef struct SceMotionState
+{
+    unsigned int timestamp;
+    SceFVector3 acceleration;
+    SceFVector3 angularVelocity;
+    uint8_t reserve1[12];
+    SceFQuaternion deviceQuat;
+    SceFMatrix4 rotationMatrix;
+    SceFMatrix4 nedMatrix;
+    uint8_t reserve2[4];
+    SceFVector3 basicOrientation;
+    SceUInt64 hostTimestamp;
+    uint8_t reserve3[40];
+} SceMotionState;
+
+typedef struct SceMotionSensorState
+{
+    SceFVector3 accelerometer;
+    SceFVector3 gyro;
+    uint8_t reserve1[12];
+    unsigned int timestamp;
+    unsigned int counter;
+    uint8_t reserve2[4];
+    SceUInt64 hostTimestamp;
+    uint8_t reserve3[8];
+} SceMotionSensorState;
+
+int sceMotionStartSampling(void);
+int sceMotionGetState(SceMotionState *motionState);
+int sceMotionGetSensorState(SceMotionSensorState *sensorState, int numRecords);
+
+#endif
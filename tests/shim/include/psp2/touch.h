@@ -0,0 +1,32 @@
+#ifndef _PSP2_TOUCH_H_
+#define _PSP2_TOUCH_H_
+
+#include <psp2/types.h>
+
+#define SCE_TOUCH_MAX_REPORT 8
+
+#define SCE_TOUCH_PORT_FRONT 0
+#define SCE_TOUCH_PORT_BACK  1
+
+typedef struct SceTouchReport
+{
+    uint8_t id;
+    uint8_t force;
+    int16_t x;
+    int16_t y;
+    int8_t reserved[8];
+    uint16_t info;
+} SceTouchReport;
+
+typedef struct SceTouchData
+{
+    SceUInt64 timeStamp;
+    SceUInt32 status;
+    SceUInt32 reportNum;
+    SceTouchReport report[SCE_TOUCH_MAX_REPORT];
+} SceTouchData;
+
+int sceTouchRead(SceUInt32 port, SceTouchData *pData, SceUInt32 nBufs);
+int sceTouchPeek(SceUInt32 port, SceTouchData *pData, SceUInt32 nBufs);
+
+#endif
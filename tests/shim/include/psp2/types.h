@@ -0,0 +1,54 @@
+#ifndef _PSP2_TYPES_H_
+#define _PSP2_TYPES_H_
+
+/* Host stand-in for the VitaSDK headers: only what the plugins use */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef int SceUID;
+typedef int SceInt32;
+typedef unsigned int SceUInt;
+typedef unsigned int SceUInt32;
+typedef unsigned int SceSize;
+typedef long long SceInt64;
+typedef unsigned long long SceUInt64;
+typedef int SceMode;
+typedef long long SceOff;
+
+typedef struct SceFVector3
+{
+    float x, y, z;
+} SceFVector3;
+
+typedef struct SceFVector4
+{
+    float x, y, z, w;
+} SceFVector4;
+
+typedef struct SceFQuaternion
+{
+    float x, y, z, w;
+} SceFQuaternion;
+
+typedef struct SceFMatrix4
+{
+    SceFVector4 x, y, z, w;
+} SceFMatrix4;
+
+typedef struct SceDateTime
+{
+    unsigned short year;
+    unsigned short month;
+    unsigned short day;
+    unsigned short hour;
+    unsigned short minute;
+    unsigned short second;
+    unsigned int microsecond;
+} SceDateTime;
+
+#define SCE_KERNEL_START_SUCCESS 0
+#define SCE_KERNEL_START_FAILED  2
+#define SCE_KERNEL_STOP_SUCCESS  0
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _PSP2KERN_BT_H_
+#define _PSP2KERN_BT_H_
+
+#include <psp2/types.h>
+
+typedef struct SceBtEvent
+{
+    union
+    {
+        unsigned char data[0x10];
+        struct
+        {
+            unsigned char id;
+            unsigned char unk1;
+            unsigned short unk2;
+            unsigned int unk3;
+            unsigned int mac0;
+            unsigned int mac1;
+        };
+    };
+} SceBtEvent;
+
+typedef struct SceBtHidRequest
+{
+    unsigned int unk00;
+    unsigned int unk04;
+    unsigned char type;
+    unsigned char unk09;
+    unsigned char unk0A;
+    unsigned char unk0B;
+    void *buffer;
+    unsigned int length;
+    struct SceBtHidRequest *next;
+} SceBtHidRequest;
+
+int ksceBtReadEvent(SceBtEvent *events, int num_events);
+int ksceBtHidTransfer(unsigned int mac0, unsigned int mac1, SceBtHidRequest *request);
+int ksceBtGetVidPid(unsigned int mac0, unsigned int mac1, unsigned short vid_pid[2]);
+int ksceBtGetDeviceName(unsigned int mac0, unsigned int mac1, char name[0x79]);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef _PSP2KERN_IO_FCNTL_H_
+#define _PSP2KERN_IO_FCNTL_H_
+
+#include <psp2/types.h>
+
+#define SCE_O_RDONLY 0x0001
+#define SCE_O_WRONLY 0x0002
+#define SCE_O_RDWR   0x0003
+#define SCE_O_APPEND 0x0100
+#define SCE_O_CREAT  0x0200
+#define SCE_O_TRUNC  0x0400
+
+#define SCE_SEEK_SET 0
+#define SCE_SEEK_CUR 1
+#define SCE_SEEK_END 2
+
+SceUID ksceIoOpen(const char *file, int flags, SceMode mode);
+int ksceIoClose(SceUID fd);
+int ksceIoRead(SceUID fd, void *data, SceSize size);
+int ksceIoWrite(SceUID fd, const void *data, SceSize size);
+SceOff ksceIoLseek(SceUID fd, SceOff offset, int whence);
+int ksceIoRemove(const char *file);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef _PSP2KERN_IO_STAT_H_
+#define _PSP2KERN_IO_STAT_H_
+
+#include <psp2/types.h>
+
+int ksceIoMkdir(const char *dir, SceMode mode);
+
+#endif
@@ -0,0 +1,6 @@
+#ifndef _PSP2KERN_KERNEL_MODULEMGR_H_
+#define _PSP2KERN_KERNEL_MODULEMGR_H_
+
+#include <psp2/types.h>
+
+#endif
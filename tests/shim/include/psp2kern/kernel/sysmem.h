@@ -0,0 +1,16 @@
+#ifndef _PSP2KERN_KERNEL_SYSMEM_H_
+#define _PSP2KERN_KERNEL_SYSMEM_H_
+
+#include <psp2/types.h>
+
+#define SCE_KERNEL_MEMBLOCK_TYPE_KERNEL_RW 0x1020D006
+
+SceUID ksceKernelAllocMemBlock(const char *name, unsigned int type, int size, void *opt);
+int ksceKernelFreeMemBlock(SceUID uid);
+int ksceKernelGetMemBlockBase(SceUID uid, void **base);
+int ksceKernelMapBlockUserVisible(SceUID uid);
+
+int ksceKernelMemcpyKernelToUser(uintptr_t dst, const void *src, size_t len);
+int ksceKernelMemcpyUserToKernel(void *dst, uintptr_t src, size_t len);
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef _PSP2KERN_KERNEL_THREADMGR_H_
+#define _PSP2KERN_KERNEL_THREADMGR_H_
+
+#include <psp2/types.h>
+
+typedef int (*SceKernelThreadEntry)(SceSize args, void *argp);
+
+#define SCE_EVENT_WAITAND      0x00000000
+#define SCE_EVENT_WAITOR       0x00000001
+#define SCE_EVENT_WAITCLEAR    0x00000002
+#define SCE_EVENT_WAITCLEAR_PAT 0x00000004
+#define SCE_EVENT_WAITMULTIPLE 0x00001000
+
+#define SCE_KERNEL_ERROR_WAIT_TIMEOUT 0x80028005
+#define SCE_KERNEL_ERROR_WAIT_DELETE  0x80028007
+
+SceUID ksceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int initPriority, int stackSize, SceUInt attr, int cpuAffinityMask, const void *option);
+int ksceKernelStartThread(SceUID thid, SceSize arglen, void *argp);
+int ksceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout);
+int ksceKernelDeleteThread(SceUID thid);
+int ksceKernelDelayThread(SceUInt delay);
+
+SceUID ksceKernelCreateEventFlag(const char *name, int attr, int bits, void *opt);
+int ksceKernelDeleteEventFlag(SceUID evfid);
+int ksceKernelSetEventFlag(SceUID evfid, unsigned int bits);
+int ksceKernelClearEventFlag(SceUID evfid, unsigned int bits);
+int ksceKernelWaitEventFlag(SceUID evfid, unsigned int bits, unsigned int wait, unsigned int *outBits, SceUInt *timeout);
+
+SceUInt64 ksceKernelGetSystemTimeWide(void);
+SceUID ksceKernelGetProcessId(void);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _TAIHEN_H_
+#define _TAIHEN_H_
+
+#include <psp2/types.h>
+
+/*
+ * Hooks are recorded by the host SDK (see host.h): a hook reference is the address of the
+ * stand-in function it replaces, so TAI_CONTINUE calls it directly.
+ */
+typedef uintptr_t tai_hook_ref_t;
+
+typedef struct
+{
+    size_t size;
+    SceUID modid;
+    uint32_t module_nid;
+    char name[27];
+    uintptr_t exports_start;
+    uintptr_t exports_end;
+    uintptr_t imports_start;
+    uintptr_t imports_end;
+} tai_module_info_t;
+
+#define KERNEL_PID 0x10005
+#define TAI_ANY_LIBRARY 0xFFFFFFFF
+#define TAI_MAIN_MODULE ((void *)0)
+
+#define TAI_CONTINUE(type, hook, ...) (((type (*)())(hook))(__VA_ARGS__))
+
+int taiGetModuleInfoForKernel(SceUID pid, const char *module, tai_module_info_t *info);
+SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func);
+int taiHookReleaseForKernel(SceUID tai_uid, tai_hook_ref_t hook);
+SceUID taiHookFunctionImport(tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func);
+int taiHookRelease(SceUID tai_uid, tai_hook_ref_t hook);
+
+#endif
@@ -0,0 +1,992 @@
+/*
+ *  DSMotion host SDK
+ *  Copyright (c) 2017 OperationNT
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+#define _GNU_SOURCE
+
+#include <psp2kern/kernel/sysmem.h>
+#include <psp2kern/kernel/threadmgr.h>
+#include <psp2kern/io/fcntl.h>
+#include <psp2kern/io/stat.h>
+#include <psp2kern/bt.h>
+#include <psp2/kernel/processmgr.h>
+#include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+#include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
+#include <psp2/appmgr.h>
+#include <taihen.h>
+#include "host.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// glibc defines it as a macro, SceIoStat has a field of this name
+#undef st_mtime
+
+#define HOST_ERROR(err) ((int)(0x80010000 | (err)))
+#define HOST_ERROR_NOT_FOUND ((int)0x80020000)
+
+#define NID_BT_READ_EVENT        0x5ABB9A9D
+#define NID_BT_HID_TRANSFER      0xF9DCEC77
+#define NID_MOTION_START         0x28034AC9
+#define NID_MOTION_GET_STATE     0xBDB32767
+#define NID_MOTION_GET_SENSOR    0x47D679EA
+#define NID_TOUCH_READ           0x169A1D58
+#define NID_TOUCH_PEEK           0xFF082DF0
+
+static pthread_mutex_t objectLock = PTHREAD_MUTEX_INITIALIZER;
+
+void hostFail(const char* iFile, int iLine, const char* iCondition)
+{
+    fprintf(stderr, "%s:%d: check failed: %s\n", iFile, iLine, iCondition);
+    exit(1);
+}
+
+/*
+ * Clock
+ */
+
+static volatile int manualClock = 0;
+static volatile unsigned long long manualTime = 0;
+static unsigned long long realOrigin = 0;
+
+unsigned long long hostNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static unsigned long long hostTime(void)
+{
+    if (manualClock)
+        return __atomic_load_n(&manualTime, __ATOMIC_ACQUIRE);
+
+    unsigned long long now = hostNanoseconds() / 1000;
+    if (0 == realOrigin)
+        realOrigin = now - 1000000; // Some time after boot, like on the console
+    return now - realOrigin;
+}
+
+void hostSetTime(unsigned long long iTimeUS)
+{
+    __atomic_store_n(&manualTime, iTimeUS, __ATOMIC_RELEASE);
+    manualClock = 1;
+}
+
+void hostAdvanceTime(unsigned int iDeltaUS)
+{
+    if (!manualClock)
+        hostSetTime(hostTime());
+    __atomic_add_fetch(&manualTime, iDeltaUS, __ATOMIC_ACQ_REL);
+}
+
+void hostUseRealTime(void)
+{
+    manualClock = 0;
+}
+
+unsigned int ksceKernelGetSystemTimeLow(void)
+{
+    return (unsigned int)hostTime();
+}
+
+SceUInt64 ksceKernelGetSystemTimeWide(void)
+{
+    return hostTime();
+}
+
+SceUInt32 sceKernelGetSystemTimeLow(void)
+{
+    return (SceUInt32)hostTime();
+}
+
+SceUInt64 sceKernelGetSystemTimeWide(void)
+{
+    return hostTime();
+}
+
+// Process time starts later than system time
+#define HOST_PROCESS_TIME_OFFSET 500000
+
+SceUInt64 sceKernelGetProcessTimeWide(void)
+{
+    return hostTime() - HOST_PROCESS_TIME_OFFSET;
+}
+
+int ksceKernelDelayThread(SceUInt delay)
+{
+    usleep(delay);
+    return 0;
+}
+
+int sceKernelDelayThread(SceUInt delay)
+{
+    usleep(delay);
+    return 0;
+}
+
+/*
+ * Processes
+ */
+
+static __thread SceUID processId = 0x40010003;
+static char titleId[16] = "HOST00001";
+
+void hostSetProcessId(SceUID iPid)
+{
+    processId = iPid;
+}
+
+SceUID ksceKernelGetProcessId(void)
+{
+    return processId;
+}
+
+SceUID sceKernelGetProcessId(void)
+{
+    return processId;
+}
+
+void hostSetTitleId(const char* iTitleId)
+{
+    snprintf(titleId, sizeof(titleId), "%s", iTitleId);
+}
+
+int sceAppMgrAppParamGetString(int pid, int param, char *string, SceSize length)
+{
+    snprintf(string, length, "%s", titleId);
+    return 0;
+}
+
+/*
+ * Memory: user and kernel share the host address space
+ */
+
+#define MAX_MEMBLOCKS 16
+
+struct hostMemBlock
+{
+    void* base;
+    SceSize size;
+};
+
+static struct hostMemBlock memBlocks[MAX_MEMBLOCKS];
+
+static SceUID allocMemBlock(SceSize size)
+{
+    void* base = NULL;
+    if (posix_memalign(&base, 4096, size) != 0)
+        return HOST_ERROR(ENOMEM);
+    memset(base, 0, size);
+
+    pthread_mutex_lock(&objectLock);
+    for (int i = 0 ; i < MAX_MEMBLOCKS ; i++)
+    {
+        if (NULL == memBlocks[i].base)
+        {
+            memBlocks[i].base = base;
+            memBlocks[i].size = size;
+            pthread_mutex_unlock(&objectLock);
+            return 0x10000 + i;
+        }
+    }
+    pthread_mutex_unlock(&objectLock);
+
+    free(base);
+    return HOST_ERROR(ENOMEM);
+}
+
+static struct hostMemBlock* getMemBlock(SceUID uid)
+{
+    int index = uid - 0x10000;
+    return (index >= 0 && index < MAX_MEMBLOCKS && NULL != memBlocks[index].base) ? &memBlocks[index] : NULL;
+}
+
+static int freeMemBlock(SceUID uid)
+{
+    struct hostMemBlock* block = getMemBlock(uid);
+    if (NULL == block)
+        return HOST_ERROR_NOT_FOUND;
+
+    free(block->base);
+    block->base = NULL;
+    return 0;
+}
+
+SceUID ksceKernelAllocMemBlock(const char *name, unsigned int type, int size, void *opt)
+{
+    return allocMemBlock(size);
+}
+
+int ksceKernelFreeMemBlock(SceUID uid)
+{
+    return freeMemBlock(uid);
+}
+
+int ksceKernelGetMemBlockBase(SceUID uid, void **base)
+{
+    struct hostMemBlock* block = getMemBlock(uid);
+    if (NULL == block)
+        return HOST_ERROR_NOT_FOUND;
+
+    *base = block->base;
+    return 0;
+}
+
+int ksceKernelMapBlockUserVisible(SceUID uid)
+{
+    return (NULL != getMemBlock(uid)) ? 0 : HOST_ERROR_NOT_FOUND;
+}
+
+SceUID sceKernelAllocMemBlock(const char *name, unsigned int type, SceSize size, void *opt)
+{
+    return allocMemBlock(size);
+}
+
+int sceKernelFreeMemBlock(SceUID uid)
+{
+    return freeMemBlock(uid);
+}
+
+int sceKernelGetMemBlockBase(SceUID uid, void **base)
+{
+    return ksceKernelGetMemBlockBase(uid, base);
+}
+
+SceUID sceKernelFindMemBlockByAddr(const void *addr, SceSize size)
+{
+    for (int i = 0 ; i < MAX_MEMBLOCKS ; i++)
+    {
+        const char* base = memBlocks[i].base;
+        if (NULL != base && (const char*)addr >= base && (const char*)addr < base + memBlocks[i].size)
+            return 0x10000 + i;
+    }
+    return HOST_ERROR_NOT_FOUND;
+}
+
+int ksceKernelMemcpyKernelToUser(uintptr_t dst, const void *src, size_t len)
+{
+    memcpy((void*)dst, src, len);
+    return 0;
+}
+
+int ksceKernelMemcpyUserToKernel(void *dst, uintptr_t src, size_t len)
+{
+    memcpy(dst, (const void*)src, len);
+    return 0;
+}
+
+/*
+ * Threads and event flags
+ */
+
+#define MAX_THREADS 8
+#define MAX_EVENT_FLAGS 8
+
+struct hostThread
+{
+    int used;
+    int started;
+    pthread_t thread;
+    SceKernelThreadEntry entry;
+    SceSize argSize;
+    void* args;
+};
+
+struct hostEventFlag
+{
+    int used;
+    unsigned int bits;
+    unsigned int generation; // Changes when deleted
+    pthread_cond_t cond;
+};
+
+static struct hostThread threads[MAX_THREADS];
+static struct hostEventFlag eventFlags[MAX_EVENT_FLAGS];
+
+static void* threadMain(void* iThread)
+{
+    struct hostThread* thread = iThread;
+    return (void*)(intptr_t)thread->entry(thread->argSize, thread->args);
+}
+
+SceUID ksceKernelCreateThread(const char *name, SceKernelThreadEntry entry, int initPriority, int stackSize, SceUInt attr, int cpuAffinityMask, const void *option)
+{
+    pthread_mutex_lock(&objectLock);
+    for (int i = 0 ; i < MAX_THREADS ; i++)
+    {
+        if (!threads[i].used)
+        {
+            memset(&threads[i], 0, sizeof(threads[i]));
+            threads[i].used = 1;
+            threads[i].entry = entry;
+            pthread_mutex_unlock(&objectLock);
+            return 0x20000 + i;
+        }
+    }
+    pthread_mutex_unlock(&objectLock);
+    return HOST_ERROR(EAGAIN);
+}
+
+static struct hostThread* getThread(SceUID uid)
+{
+    int index = uid - 0x20000;
+    return (index >= 0 && index < MAX_THREADS && threads[index].used) ? &threads[index] : NULL;
+}
+
+int ksceKernelStartThread(SceUID thid, SceSize arglen, void *argp)
+{
+    struct hostThread* thread = getThread(thid);
+    if (NULL == thread || thread->started)
+        return HOST_ERROR_NOT_FOUND;
+
+    thread->argSize = arglen;
+    thread->args = argp;
+    if (pthread_create(&thread->thread, NULL, threadMain, thread) != 0)
+        return HOST_ERROR(EAGAIN);
+
+    thread->started = 1;
+    return 0;
+}
+
+int ksceKernelWaitThreadEnd(SceUID thid, int *stat, SceUInt *timeout)
+{
+    struct hostThread* thread = getThread(thid);
+    if (NULL == thread || !thread->started)
+        return HOST_ERROR_NOT_FOUND;
+
+    void* result;
+    pthread_join(thread->thread, &result);
+    thread->started = 0;
+    if (NULL != stat)
+        *stat = (int)(intptr_t)result;
+    return 0;
+}
+
+int ksceKernelDeleteThread(SceUID thid)
+{
+    struct hostThread* thread = getThread(thid);
+    if (NULL == thread)
+        return HOST_ERROR_NOT_FOUND;
+
+    if (thread->started)
+        pthread_detach(thread->thread);
+    thread->used = 0;
+    return 0;
+}
+
+SceUID ksceKernelCreateEventFlag(const char *name, int attr, int bits, void *opt)
+{
+    pthread_mutex_lock(&objectLock);
+    for (int i = 0 ; i < MAX_EVENT_FLAGS ; i++)
+    {
+        struct hostEventFlag* evf = &eventFlags[i];
+        if (!evf->used)
+        {
+            pthread_condattr_t condAttr;
+            pthread_condattr_init(&condAttr);
+            pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+            pthread_cond_init(&evf->cond, &condAttr);
+            pthread_condattr_destroy(&condAttr);
+
+            evf->used = 1;
+            evf->bits = bits;
+            pthread_mutex_unlock(&objectLock);
+            return 0x30000 + i;
+        }
+    }
+    pthread_mutex_unlock(&objectLock);
+    return HOST_ERROR(EAGAIN);
+}
+
+// Object lock must be held
+static struct hostEventFlag* getEventFlag(SceUID uid)
+{
+    int index = uid - 0x30000;
+    return (index >= 0 && index < MAX_EVENT_FLAGS && eventFlags[index].used) ? &eventFlags[index] : NULL;
+}
+
+int ksceKernelDeleteEventFlag(SceUID evfid)
+{
+    pthread_mutex_lock(&objectLock);
+    struct hostEventFlag* evf = getEventFlag(evfid);
+    if (NULL != evf)
+    {
+        evf->used = 0;
+        evf->generation++;
+        pthread_cond_broadcast(&evf->cond);
+    }
+    pthread_mutex_unlock(&objectLock);
+    return (NULL != evf) ? 0 : HOST_ERROR_NOT_FOUND;
+}
+
+int ksceKernelSetEventFlag(SceUID evfid, unsigned int bits)
+{
+    pthread_mutex_lock(&objectLock);
+    struct hostEventFlag* evf = getEventFlag(evfid);
+    if (NULL != evf)
+    {
+        evf->bits |= bits;
+        pthread_cond_broadcast(&evf->cond);
+    }
+    pthread_mutex_unlock(&objectLock);
+    return (NULL != evf) ? 0 : HOST_ERROR_NOT_FOUND;
+}
+
+int ksceKernelClearEventFlag(SceUID evfid, unsigned int bits)
+{
+    pthread_mutex_lock(&objectLock);
+    struct hostEventFlag* evf = getEventFlag(evfid);
+    if (NULL != evf)
+        evf->bits &= bits;
+    pthread_mutex_unlock(&objectLock);
+    return (NULL != evf) ? 0 : HOST_ERROR_NOT_FOUND;
+}
+
+static void deadlineAfter(struct timespec* oDeadline, SceUInt iTimeoutUS)
+{
+    clock_gettime(CLOCK_MONOTONIC, oDeadline);
+    unsigned long long nsec = oDeadline->tv_nsec + (unsigned long long)iTimeoutUS * 1000;
+    oDeadline->tv_sec += nsec / 1000000000;
+    oDeadline->tv_nsec = nsec % 1000000000;
+}
+
+int ksceKernelWaitEventFlag(SceUID evfid, unsigned int bits, unsigned int wait, unsigned int *outBits, SceUInt *timeout)
+{
+    struct timespec deadline;
+    if (NULL != timeout)
+        deadlineAfter(&deadline, *timeout);
+
+    pthread_mutex_lock(&objectLock);
+    struct hostEventFlag* evf = getEventFlag(evfid);
+    if (NULL == evf)
+    {
+        pthread_mutex_unlock(&objectLock);
+        return HOST_ERROR_NOT_FOUND;
+    }
+
+    unsigned int generation = evf->generation;
+    int res = 0;
+    for (;;)
+    {
+        unsigned int matched = evf->bits & bits;
+        if ((wait & SCE_EVENT_WAITOR) ? (0 != matched) : (bits == matched))
+        {
+            if (NULL != outBits)
+                *outBits = evf->bits;
+            if (wait & SCE_EVENT_WAITCLEAR)
+                evf->bits &= ~bits;
+            if (wait & SCE_EVENT_WAITCLEAR_PAT)
+                evf->bits = 0;
+            break;
+        }
+
+        int err = (NULL != timeout) ? pthread_cond_timedwait(&evf->cond, &objectLock, &deadline) : pthread_cond_wait(&evf->cond, &objectLock);
+        if (generation != evf->generation)
+        {
+            res = SCE_KERNEL_ERROR_WAIT_DELETE;
+            break;
+        }
+        if (ETIMEDOUT == err)
+        {
+            res = SCE_KERNEL_ERROR_WAIT_TIMEOUT;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&objectLock);
+
+    // Remaining time is given back, like the console does
+    if (NULL != timeout)
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long remaining = (deadline.tv_sec - now.tv_sec) * 1000000LL + (deadline.tv_nsec - now.tv_nsec) / 1000;
+        *timeout = (remaining > 0) ? remaining : 0;
+    }
+    return res;
+}
+
+/*
+ * Files
+ */
+
+static char rootDirectory[256] = ".";
+
+const char* hostSetRoot(const char* iDirectory)
+{
+    if (NULL != iDirectory)
+    {
+        snprintf(rootDirectory, sizeof(rootDirectory), "%s", iDirectory);
+        return rootDirectory;
+    }
+
+    const char* tmp = getenv("TMPDIR");
+    snprintf(rootDirectory, sizeof(rootDirectory), "%s/dsmotion-XXXXXX", (NULL != tmp) ? tmp : "/tmp");
+    if (NULL == mkdtemp(rootDirectory))
+    {
+        perror(rootDirectory);
+        exit(1);
+    }
+    return rootDirectory;
+}
+
+const char* hostPath(const char* iVitaPath, char* oPath, unsigned int iSize)
+{
+    // "ux0:data/x" is "<root>/ux0/data/x"
+    const char* colon = strchr(iVitaPath, ':');
+    if (NULL == colon)
+        snprintf(oPath, iSize, "%s/%s", rootDirectory, iVitaPath);
+    else
+        snprintf(oPath, iSize, "%s/%.*s/%s", rootDirectory, (int)(colon-iVitaPath), iVitaPath, colon+1);
+    return oPath;
+}
+
+// Parent directories exist on the console
+static void makeParents(const char* iPath)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s", iPath);
+    for (char* slash = strchr(path+1, '/') ; NULL != slash ; slash = strchr(slash+1, '/'))
+    {
+        *slash = 0;
+        mkdir(path, 0777);
+        *slash = '/';
+    }
+}
+
+static SceUID ioOpen(const char *file, int flags, SceMode mode)
+{
+    char path[512];
+    hostPath(file, path, sizeof(path));
+
+    int hostFlags = ((flags & SCE_O_RDWR) == SCE_O_RDWR) ? O_RDWR : ((flags & SCE_O_WRONLY) ? O_WRONLY : O_RDONLY);
+    if (flags & SCE_O_APPEND)
+        hostFlags |= O_APPEND;
+    if (flags & SCE_O_CREAT)
+    {
+        hostFlags |= O_CREAT;
+        makeParents(path);
+    }
+    if (flags & SCE_O_TRUNC)
+        hostFlags |= O_TRUNC;
+
+    int fd = open(path, hostFlags, 0666);
+    return (fd >= 0) ? fd : HOST_ERROR(errno);
+}
+
+static int ioResult(long iResult)
+{
+    return (iResult >= 0) ? (int)iResult : HOST_ERROR(errno);
+}
+
+static int ioMkdir(const char *dir)
+{
+    char path[512];
+    hostPath(dir, path, sizeof(path));
+    makeParents(path);
+    return ioResult(mkdir(path, 0777));
+}
+
+static int ioRemove(const char *file)
+{
+    char path[512];
+    return ioResult(unlink(hostPath(file, path, sizeof(path))));
+}
+
+SceUID ksceIoOpen(const char *file, int flags, SceMode mode)
+{
+    return ioOpen(file, flags, mode);
+}
+
+int ksceIoClose(SceUID fd)
+{
+    return ioResult(close(fd));
+}
+
+int ksceIoRead(SceUID fd, void *data, SceSize size)
+{
+    return ioResult(read(fd, data, size));
+}
+
+int ksceIoWrite(SceUID fd, const void *data, SceSize size)
+{
+    return ioResult(write(fd, data, size));
+}
+
+SceOff ksceIoLseek(SceUID fd, SceOff offset, int whence)
+{
+    off_t res = lseek(fd, offset, (SCE_SEEK_END == whence) ? SEEK_END : ((SCE_SEEK_CUR == whence) ? SEEK_CUR : SEEK_SET));
+    return (res >= 0) ? res : HOST_ERROR(errno);
+}
+
+int ksceIoRemove(const char *file)
+{
+    return ioRemove(file);
+}
+
+int ksceIoMkdir(const char *dir, SceMode mode)
+{
+    return ioMkdir(dir);
+}
+
+SceUID sceIoOpen(const char *file, int flags, SceMode mode)
+{
+    return ioOpen(file, flags, mode);
+}
+
+int sceIoClose(SceUID fd)
+{
+    return ksceIoClose(fd);
+}
+
+int sceIoRead(SceUID fd, void *data, SceSize size)
+{
+    return ksceIoRead(fd, data, size);
+}
+
+int sceIoWrite(SceUID fd, const void *data, SceSize size)
+{
+    return ksceIoWrite(fd, data, size);
+}
+
+SceOff sceIoLseek(SceUID fd, SceOff offset, int whence)
+{
+    return ksceIoLseek(fd, offset, whence);
+}
+
+int sceIoRemove(const char *file)
+{
+    return ioRemove(file);
+}
+
+int sceIoMkdir(const char *dir, SceMode mode)
+{
+    return ioMkdir(dir);
+}
+
+int sceIoGetstat(const char *file, SceIoStat *stat)
+{
+    char path[512];
+    struct stat hostStat;
+    if (lstat(hostPath(file, path, sizeof(path)), &hostStat) < 0)
+        return HOST_ERROR(errno);
+
+    memset(stat, 0, sizeof(*stat));
+    stat->st_size = hostStat.st_size;
+
+    struct tm tm;
+    gmtime_r(&hostStat.st_mtim.tv_sec, &tm);
+    stat->st_mtime.year = tm.tm_year + 1900;
+    stat->st_mtime.month = tm.tm_mon + 1;
+    stat->st_mtime.day = tm.tm_mday;
+    stat->st_mtime.hour = tm.tm_hour;
+    stat->st_mtime.minute = tm.tm_min;
+    stat->st_mtime.second = tm.tm_sec;
+    stat->st_mtime.microsecond = hostStat.st_mtim.tv_nsec / 1000;
+    return 0;
+}
+
+/*
+ * Hooks: one per function NID, the reference is the stand-in original
+ */
+
+#define MAX_HOOKS 16
+
+struct hostHook
+{
+    uint32_t nid;
+    const void* func;
+};
+
+static struct hostHook hooks[MAX_HOOKS];
+
+static SceBtEvent pendingEvent;
+static unsigned char hidBuffer[0x100];
+
+static int originalBtReadEvent(SceBtEvent *events, int num_events)
+{
+    if (num_events < 1 || 0 == pendingEvent.id)
+        return 0;
+
+    events[0] = pendingEvent;
+    memset(&pendingEvent, 0, sizeof(pendingEvent));
+    return 1;
+}
+
+static int originalBtHidTransfer(unsigned int mac0, unsigned int mac1, SceBtHidRequest *request)
+{
+    return 0;
+}
+
+static int originalMotionStartSampling(void)
+{
+    return 0;
+}
+
+// SceMotion only fills its own times when no sensor is there
+static int originalMotionGetState(SceMotionState *motionState)
+{
+    memset(motionState, 0, sizeof(*motionState));
+    motionState->timestamp = sceKernelGetSystemTimeLow();
+    motionState->hostTimestamp = sceKernelGetProcessTimeWide();
+    motionState->deviceQuat.w = 1.f;
+    return 0;
+}
+
+static int originalMotionGetSensorState(SceMotionSensorState *sensorState, int numRecords)
+{
+    memset(sensorState, 0, numRecords * sizeof(SceMotionSensorState));
+    return 0;
+}
+
+// Console panels report no finger, buffers 1ms apart ending now
+static int originalTouchRead(SceUInt32 port, SceTouchData *pData, SceUInt32 nBufs)
+{
+    SceUInt64 now = sceKernelGetProcessTimeWide();
+    for (SceUInt32 i = 0 ; i < nBufs ; i++)
+    {
+        memset(&pData[i], 0, sizeof(SceTouchData));
+        pData[i].timeStamp = now - (nBufs-1-i) * 1000;
+    }
+    return nBufs;
+}
+
+static const void* getOriginal(uint32_t iFuncNid)
+{
+    switch (iFuncNid)
+    {
+    case NID_BT_READ_EVENT:     return originalBtReadEvent;
+    case NID_BT_HID_TRANSFER:   return originalBtHidTransfer;
+    case NID_MOTION_START:      return originalMotionStartSampling;
+    case NID_MOTION_GET_STATE:  return originalMotionGetState;
+    case NID_MOTION_GET_SENSOR: return originalMotionGetSensorState;
+    case NID_TOUCH_READ:        return originalTouchRead;
+    case NID_TOUCH_PEEK:        return originalTouchRead;
+    default:                    return NULL;
+    }
+}
+
+static SceUID bindHook(tai_hook_ref_t *p_hook, uint32_t func_nid, const void *hook_func)
+{
+    const void* original = getOriginal(func_nid);
+    if (NULL == original)
+        return HOST_ERROR_NOT_FOUND;
+
+    for (int i = 0 ; i < MAX_HOOKS ; i++)
+    {
+        if (NULL == hooks[i].func)
+        {
+            hooks[i].nid = func_nid;
+            hooks[i].func = hook_func;
+            *p_hook = (tai_hook_ref_t)original;
+            return 0x40000 + i;
+        }
+    }
+    return HOST_ERROR(ENOMEM);
+}
+
+static int releaseHook(SceUID tai_uid)
+{
+    int index = tai_uid - 0x40000;
+    if (index < 0 || index >= MAX_HOOKS || NULL == hooks[index].func)
+        return HOST_ERROR_NOT_FOUND;
+
+    hooks[index].func = NULL;
+    return 0;
+}
+
+const void* hostGetHook(uint32_t iFuncNid)
+{
+    for (int i = 0 ; i < MAX_HOOKS ; i++)
+    {
+        if (NULL != hooks[i].func && iFuncNid == hooks[i].nid)
+            return hooks[i].func;
+    }
+    return NULL;
+}
+
+static const void* getFunction(uint32_t iFuncNid)
+{
+    const void* hook = hostGetHook(iFuncNid);
+    return (NULL != hook) ? hook : getOriginal(iFuncNid);
+}
+
+int taiGetModuleInfoForKernel(SceUID pid, const char *module, tai_module_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+    info->size = sizeof(*info);
+    snprintf(info->name, sizeof(info->name), "%s", module);
+    return 0;
+}
+
+SceUID taiHookFunctionExportForKernel(SceUID pid, tai_hook_ref_t *p_hook, const char *module, uint32_t library_nid, uint32_t func_nid, const void *hook_func)
+{
+    return bindHook(p_hook, func_nid, hook_func);
+}
+
+int taiHookReleaseForKernel(SceUID tai_uid, tai_hook_ref_t hook)
+{
+    return releaseHook(tai_uid);
+}
+
+SceUID taiHookFunctionImport(tai_hook_ref_t *p_hook, const char *module, uint32_t import_library_nid, uint32_t import_func_nid, const void *hook_func)
+{
+    return bindHook(p_hook, import_func_nid, hook_func);
+}
+
+int taiHookRelease(SceUID tai_uid, tai_hook_ref_t hook)
+{
+    return releaseHook(tai_uid);
+}
+
+int hostMotionStartSampling(void)
+{
+    return ((int (*)(void))getFunction(NID_MOTION_START))();
+}
+
+int hostMotionGetState(SceMotionState* oState)
+{
+    return ((int (*)(SceMotionState*))getFunction(NID_MOTION_GET_STATE))(oState);
+}
+
+int hostMotionGetSensorState(SceMotionSensorState* oStates, int iNumRecords)
+{
+    return ((int (*)(SceMotionSensorState*, int))getFunction(NID_MOTION_GET_SENSOR))(oStates, iNumRecords);
+}
+
+int hostTouchRead(SceUInt32 iPort, SceTouchData* oData, SceUInt32 iNbBufs)
+{
+    return ((int (*)(SceUInt32, SceTouchData*, SceUInt32))getFunction(NID_TOUCH_READ))(iPort, oData, iNbBufs);
+}
+
+int hostTouchPeek(SceUInt32 iPort, SceTouchData* oData, SceUInt32 iNbBufs)
+{
+    return ((int (*)(SceUInt32, SceTouchData*, SceUInt32))getFunction(NID_TOUCH_PEEK))(iPort, oData, iNbBufs);
+}
+
+/*
+ * BlueTooth
+ */
+
+#define MAX_BT_DEVICES 8
+
+struct hostBtDevice
+{
+    unsigned int mac0;
+    unsigned int mac1;
+    unsigned short vidPid[2];
+};
+
+static struct hostBtDevice btDevices[MAX_BT_DEVICES];
+static int nbBtDevices = 0;
+
+void hostBtSetVidPid(unsigned int iMac0, unsigned int iMac1, unsigned short iVid, unsigned short iPid)
+{
+    if (nbBtDevices < MAX_BT_DEVICES)
+    {
+        struct hostBtDevice device = {iMac0, iMac1, {iVid, iPid}};
+        btDevices[nbBtDevices++] = device;
+    }
+}
+
+int ksceBtGetVidPid(unsigned int mac0, unsigned int mac1, unsigned short vid_pid[2])
+{
+    for (int i = 0 ; i < nbBtDevices ; i++)
+    {
+        if (mac0 == btDevices[i].mac0 && mac1 == btDevices[i].mac1)
+        {
+            vid_pid[0] = btDevices[i].vidPid[0];
+            vid_pid[1] = btDevices[i].vidPid[1];
+            return 0;
+        }
+    }
+
+    vid_pid[0] = vid_pid[1] = 0;
+    return (int)0x802F5001;
+}
+
+// Like the DS3 that give neither their identifiers nor their name
+int ksceBtGetDeviceName(unsigned int mac0, unsigned int mac1, char name[0x79])
+{
+    name[0] = 0;
+    return (int)0x802F0C01;
+}
+
+int ksceBtReadEvent(SceBtEvent *events, int num_events)
+{
+    return ((int (*)(SceBtEvent*, int))getFunction(NID_BT_READ_EVENT))(events, num_events);
+}
+
+int ksceBtHidTransfer(unsigned int mac0, unsigned int mac1, SceBtHidRequest *request)
+{
+    return ((int (*)(unsigned int, unsigned int, SceBtHidRequest*))getFunction(NID_BT_HID_TRANSFER))(mac0, mac1, request);
+}
+
+int hostBtEvent(unsigned char iId, unsigned int iMac0, unsigned int iMac1)
+{
+    memset(&pendingEvent, 0, sizeof(pendingEvent));
+    pendingEvent.id = iId;
+    pendingEvent.mac0 = iMac0;
+    pendingEvent.mac1 = iMac1;
+
+    SceBtEvent events[1];
+    return ksceBtReadEvent(events, 1);
+}
+
+int hostBtConnect(unsigned int iMac0, unsigned int iMac1)
+{
+    return hostBtEvent(0x05, iMac0, iMac1);
+}
+
+int hostBtDisconnect(unsigned int iMac0, unsigned int iMac1)
+{
+    return hostBtEvent(0x06, iMac0, iMac1);
+}
+
+// Same sequence as a controller plugin: receive request, then the report arrives with a 0x0A event
+int hostBtReport(unsigned int iMac0, unsigned int iMac1, const void* iReport, unsigned int iSize)
+{
+    if (iSize > sizeof(hidBuffer))
+        return HOST_ERROR(EINVAL);
+
+    SceBtHidRequest request;
+    memset(&request, 0, sizeof(request));
+    request.buffer = hidBuffer;
+    request.length = sizeof(hidBuffer);
+
+    int ret = ksceBtHidTransfer(iMac0, iMac1, &request);
+    if (ret < 0)
+        return ret;
+
+    memset(hidBuffer, 0, sizeof(hidBuffer));
+    memcpy(hidBuffer, iReport, iSize);
+    return hostBtEvent(0x0A, iMac0, iMac1);
+}
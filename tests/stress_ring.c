@@ -0,0 +1,185 @@
+/*
+ * Sample ring stress test: one thread writes samples through the kernel plugin writeSample
+ * as fast as it can while reader threads read them with every lock-free reader.
+ * Each sample content is derived from its counter, so a torn read can't go unnoticed.
+ * Usage: stress_ring [samples]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "host.h"
+
+#include "../kernel/main.c"
+
+#define NB_READERS 4
+#define SAMPLE_PERIOD_US 1000
+#define WINDOW_US 20000
+#define CONSTANT_ACCEL 1000
+#define CONSTANT_GYRO -1000
+
+static volatile int producerDone = 0;
+
+static void makeSample(unsigned int iCounter, struct accelGyroData* oData)
+{
+    oData->accel[0] = (signed short)iCounter;
+    oData->accel[1] = (signed short)(iCounter >> 16);
+    oData->accel[2] = CONSTANT_ACCEL;
+    oData->gyro[0] = (signed short)~iCounter;
+    oData->gyro[1] = (signed short)(iCounter * 7);
+    oData->gyro[2] = CONSTANT_GYRO;
+    oData->timestamp = iCounter * SAMPLE_PERIOD_US;
+    oData->counter = 0;
+}
+
+static void checkSample(const struct accelGyroData* iData)
+{
+    struct accelGyroData expected;
+    makeSample(iData->counter, &expected);
+    expected.counter = iData->counter;
+    HOST_CHECK(0 != iData->counter);
+    HOST_CHECK(0 == memcmp(iData, &expected, sizeof(expected)));
+}
+
+struct readerStats
+{
+    unsigned int reads;
+    unsigned int failures; // Retries exhausted, allowed under contention
+    unsigned int samples;
+    unsigned int lost;
+};
+
+static void readLast(const struct dsSharedDevice* iRing, struct readerStats* ioStats)
+{
+    struct accelGyroData data;
+    if (0 != dsReadLastSample(iRing, &data))
+    {
+        checkSample(&data);
+        ioStats->samples++;
+    }
+    else
+    {
+        ioStats->failures++;
+    }
+}
+
+static void readHistory(const struct dsSharedDevice* iRing, struct readerStats* ioStats)
+{
+    struct accelGyroData data[64];
+    int count = dsReadHistory(iRing, 3, 64, data);
+    for (int i = 0 ; i < count ; i++)
+    {
+        checkSample(&data[i]);
+        HOST_CHECK(0 == i || data[i].counter == data[i-1].counter+1);
+    }
+    ioStats->samples += count;
+    ioStats->failures += (0 == count);
+}
+
+static void readAverage(const struct dsSharedDevice* iRing, struct readerStats* ioStats)
+{
+    signed short accel[3];
+    signed short gyro[3];
+    unsigned int lastCounter;
+    int count = dsReadWindowAverage(iRing, WINDOW_US, accel, gyro, &lastCounter);
+    if (count > 0)
+    {
+        HOST_CHECK(count <= WINDOW_US / SAMPLE_PERIOD_US + 1);
+        HOST_CHECK(CONSTANT_ACCEL == accel[2]);
+        HOST_CHECK(CONSTANT_GYRO == gyro[2]);
+        ioStats->samples += count;
+    }
+    else
+    {
+        ioStats->failures++;
+    }
+}
+
+// Every sample is either received once, in order, or counted as lost
+static void readNew(unsigned int* ioLastCounter, struct readerStats* ioStats)
+{
+    struct accelGyroData data[32];
+    unsigned int lost = 0;
+    int count = dsGetDeviceNewAccelGyro(0, 32, data, &lost);
+    HOST_CHECK(count >= 0);
+
+    for (int i = 0 ; i < count ; i++)
+    {
+        checkSample(&data[i]);
+        unsigned int expected = (0 == i) ? *ioLastCounter + lost + 1 : data[i-1].counter + 1;
+        HOST_CHECK((0 == i && 0 == *ioLastCounter) || data[i].counter == expected);
+    }
+    if (count > 0)
+        *ioLastCounter = data[count-1].counter;
+
+    ioStats->samples += count;
+    ioStats->lost += lost;
+}
+
+static void* readerThread(void* iIndex)
+{
+    int index = (int)(intptr_t)iIndex;
+    hostSetProcessId(0x40010010 + index);
+
+    const struct dsSharedDevice* ring = devices[0].ring;
+    struct readerStats stats = {0};
+    unsigned int lastNewCounter = 0;
+
+    while (!producerDone)
+    {
+        switch ((index + stats.reads) % 4)
+        {
+        case 0: readLast(ring, &stats); break;
+        case 1: readHistory(ring, &stats); break;
+        case 2: readAverage(ring, &stats); break;
+        case 3: readNew(&lastNewCounter, &stats); break;
+        }
+        stats.reads++;
+    }
+
+    printf("reader %d: %u reads, %u samples checked, %u lost, %u busy\n", index, stats.reads, stats.samples, stats.lost, stats.failures);
+    return NULL;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 10000000;
+    HOST_CHECK(count > DS_HISTORY_SIZE);
+
+    hostSetRoot(NULL);
+    sharedOpen();
+
+    struct dsDevice* device = &devices[0];
+    device->type = DS_DEVICE_DS4;
+    device->ring->type = DS_DEVICE_DS4;
+    updatePrimaryDevice();
+
+    // Readers start once samples fill the ring
+    struct accelGyroData data;
+    unsigned int counter = 1;
+    for ( ; counter <= DS_HISTORY_SIZE ; counter++)
+    {
+        makeSample(counter, &data);
+        writeSample(device, &ds4Descriptor.scale, &data);
+    }
+
+    pthread_t readers[NB_READERS];
+    for (int i = 0 ; i < NB_READERS ; i++)
+        HOST_CHECK(0 == pthread_create(&readers[i], NULL, readerThread, (void*)(intptr_t)i));
+
+    unsigned long long start = hostNanoseconds();
+    for ( ; counter <= count ; counter++)
+    {
+        makeSample(counter, &data);
+        writeSample(device, &ds4Descriptor.scale, &data);
+    }
+    unsigned long long duration = hostNanoseconds() - start;
+    producerDone = 1;
+
+    for (int i = 0 ; i < NB_READERS ; i++)
+        pthread_join(readers[i], NULL);
+
+    HOST_CHECK(count == device->ring->counter);
+    printf("writer: %u samples, %.1f ns per sample\n", count, (double)duration / (count - DS_HISTORY_SIZE));
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * Sample wait: threads of several processes wait for each sample of the same controller,
+ * each of them must be woken for every sample, and return when the controller disconnects.
+ * Usage: wait_sample [reports]
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "../DSMotionLibrary.h"
+
+#define SONY_VID 0x054C
+#define DS4_PID  0x05C4
+#define WAIT_MAC 0xEE0004
+#define NB_WAITERS 4
+#define WAIT_TIMEOUT_US 2000000
+
+struct waiterState
+{
+    int index;
+    volatile unsigned int lastCounter;
+    unsigned int wakeups;
+    int result;
+};
+
+static void* waiterThread(void* iState)
+{
+    struct waiterState* state = iState;
+    hostSetProcessId(0x40010030 + state->index);
+
+    for (;;)
+    {
+        unsigned int counter = 0;
+        int ret = dsWaitForSample(0, state->lastCounter, WAIT_TIMEOUT_US, &counter);
+        if (ret <= 0)
+        {
+            state->result = ret;
+            return NULL;
+        }
+
+        HOST_CHECK(1 == ret && counter != state->lastCounter);
+        state->lastCounter = counter;
+        state->wakeups++;
+    }
+}
+
+static void sendReport(unsigned int iIndex)
+{
+    unsigned char report[64] = {0x11};
+    report[10] = (iIndex * 3 / 16) & 0xFF;
+    report[11] = ((iIndex * 3 / 16) >> 8) & 0xFF;
+    hostAdvanceTime(1000);
+    HOST_CHECK(hostBtReport(WAIT_MAC, 0, report, sizeof(report)) >= 0);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned int count = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+    HOST_CHECK(count > 0);
+
+    hostSetRoot(NULL);
+    hostSetTime(1000000);
+    hostBtSetVidPid(WAIT_MAC, 0, SONY_VID, DS4_PID);
+    HOST_CHECK(dsKernelModuleStart(0, NULL) == SCE_KERNEL_START_SUCCESS);
+
+    // Not connected yet
+    HOST_CHECK(dsWaitForSample(0, 0, 1000, NULL) < 0);
+
+    HOST_CHECK(hostBtConnect(WAIT_MAC, 0) >= 0);
+    sendReport(0);
+
+    // Nothing new: times out
+    unsigned int counter = dsGetDeviceCounter(0);
+    HOST_CHECK(dsWaitForSample(0, counter, 10000, NULL) == 0);
+
+    struct waiterState waiters[NB_WAITERS];
+    pthread_t threads[NB_WAITERS];
+    for (int i = 0 ; i < NB_WAITERS ; i++)
+    {
+        memset(&waiters[i], 0, sizeof(waiters[i]));
+        waiters[i].index = i;
+        waiters[i].lastCounter = counter;
+        HOST_CHECK(0 == pthread_create(&threads[i], NULL, waiterThread, &waiters[i]));
+    }
+
+    // Reports are sent once every waiter got the previous one: each of them must be woken every time
+    for (unsigned int i = 1 ; i <= count ; i++)
+    {
+        sendReport(i);
+        unsigned int expected = counter + i;
+        for (int w = 0 ; w < NB_WAITERS ; w++)
+        {
+            while (waiters[w].lastCounter != expected && 0 == waiters[w].result)
+                sched_yield();
+        }
+    }
+
+    // Waiters return as soon as the controller disconnects
+    HOST_CHECK(hostBtDisconnect(WAIT_MAC, 0) >= 0);
+    for (int i = 0 ; i < NB_WAITERS ; i++)
+    {
+        pthread_join(threads[i], NULL);
+        printf("waiter %d: %u wakeups, result %d\n", i, waiters[i].wakeups, waiters[i].result);
+        HOST_CHECK(waiters[i].wakeups == count);
+        HOST_CHECK(waiters[i].result < 0);
+    }
+
+    dsKernelModuleStop(0, NULL);
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * Host decoder of the kernel plugin trace file: prints the records of each plugin start as a timeline.
+ * Build: gcc -o dstrace tools/dstrace.c
+ * Usage: ./dstrace trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../DSMotionTrace.h"
+
+struct timedRecord
+{
+    unsigned int start; // Header before the record
+    long long time;     // us since the plugin start
+    unsigned int index;
+    struct dsTraceRecord record;
+};
+
+static const char* eventName(unsigned int iEvent)
+{
+    switch (iEvent)
+    {
+    case DS_TRACE_LOST:             return "lost";
+    case DS_TRACE_MODULE_START:     return "module_start";
+    case DS_TRACE_BT_EVENT:         return "bt_event";
+    case DS_TRACE_HID_TRANSFER:     return "hid_transfer";
+    case DS_TRACE_REPORT:           return "report";
+    case DS_TRACE_REPORT_REJECTED:  return "report_rejected";
+    case DS_TRACE_VID_PID:          return "vid_pid";
+    case DS_TRACE_CONNECT:          return "connect";
+    case DS_TRACE_DISCONNECT:       return "disconnect";
+    case DS_TRACE_READ_EVENT_END:   return "read_event_end";
+    case DS_TRACE_USER_START:       return "user_start";
+    case DS_TRACE_USER_STOP:        return "user_stop";
+    case DS_TRACE_START_SAMPLING:   return "start_sampling";
+    case DS_TRACE_GET_STATE:        return "get_state";
+    case DS_TRACE_GET_SENSOR_STATE: return "get_sensor_state";
+    case DS_TRACE_TOUCH:            return "touch";
+    case DS_TRACE_STATE_CACHE:      return "state_cache";
+    default:                        return NULL;
+    }
+}
+
+// Records and headers have the same size: a header starts with the magic where a record has its sequence
+static int readHeader(const struct dsTraceRecord* iRecord, const char* iPath, struct dsTraceHeader* oHeader)
+{
+    memcpy(oHeader, iRecord, sizeof(*oHeader));
+    if (oHeader->magic != DS_TRACE_MAGIC)
+        return 0;
+
+    if (oHeader->version != DS_TRACE_VERSION)
+    {
+        fprintf(stderr, "%s: unsupported version %u\n", iPath, oHeader->version);
+        return -1;
+    }
+    return 1;
+}
+
+static int compareRecords(const void* iLeft, const void* iRight)
+{
+    const struct timedRecord* left = iLeft;
+    const struct timedRecord* right = iRight;
+
+    if (left->start != right->start)
+        return (left->start < right->start) ? -1 : 1;
+    if (left->time != right->time)
+        return (left->time < right->time) ? -1 : 1;
+    if (left->index != right->index) // Keep file order for equal timestamps
+        return (left->index < right->index) ? -1 : 1;
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s trace.bin\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (!file)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    struct dsTraceRecord record;
+    struct dsTraceHeader header = {0};
+    if (fread(&record, sizeof(record), 1, file) != 1 || 1 != readHeader(&record, argv[1], &header))
+    {
+        if (header.magic != DS_TRACE_MAGIC)
+            fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        fclose(file);
+        return 1;
+    }
+
+    struct timedRecord* records = NULL;
+    unsigned int nbRecords = 0, capacity = 0;
+    unsigned int start = 0;
+    long long lastTime = 0;
+    unsigned int lastTimestamp = header.timestamp;
+
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        // Plugin started again: its clock has nothing to do with the previous one
+        int isHeader = readHeader(&record, argv[1], &header);
+        if (isHeader < 0)
+        {
+            free(records);
+            fclose(file);
+            return 1;
+        }
+        if (isHeader)
+        {
+            start++;
+            lastTime = 0;
+            lastTimestamp = header.timestamp;
+            continue;
+        }
+
+        if (nbRecords == capacity)
+        {
+            capacity = capacity ? capacity*2 : 4096;
+            struct timedRecord* grown = realloc(records, capacity*sizeof(struct timedRecord));
+            if (!grown)
+            {
+                fprintf(stderr, "Out of memory\n");
+                free(records);
+                fclose(file);
+                return 1;
+            }
+            records = grown;
+        }
+
+        // Timestamps are 32 bits wide: records are written close enough in time to unwrap them with a signed delta
+        lastTime += (int)(record.timestamp - lastTimestamp);
+        lastTimestamp = record.timestamp;
+
+        records[nbRecords].start = start;
+        records[nbRecords].time = lastTime;
+        records[nbRecords].index = nbRecords;
+        records[nbRecords].record = record;
+        nbRecords++;
+    }
+    fclose(file);
+
+    qsort(records, nbRecords, sizeof(struct timedRecord), compareRecords);
+
+    for (unsigned int i = 0; i < nbRecords; i++)
+    {
+        const struct dsTraceRecord* current = &records[i].record;
+        const char* name = eventName(current->event);
+
+        if (0 == i || records[i].start != records[i-1].start)
+            printf("--- start %u\n", records[i].start);
+
+        printf("%12.6f cpu%u #%-8u ", records[i].time/1000000.0, current->cpu, current->sequence);
+        if (name)
+            printf("%-16s", name);
+        else
+            printf("event_%04x      ", current->event);
+        printf(" %d %d %d\n", current->args[0], current->args[1], current->args[2]);
+    }
+
+    free(records);
+    return 0;
+}
@@ -0,0 +1,208 @@
+#ifndef FastMath_H
+#define FastMath_H
+
+/*
+ * Float math without libm: minimax polynomials (Cephes single precision coefficients)
+ * after range reduction, Newton refined square roots.
+ * Errors are close to float precision (a few 1e-7) on the whole float range used here.
+ */
+
+#ifndef M_PI
+#define M_PI 3.14159265359f
+#endif
+
+#define FASTMATH_PI_2 1.57079632679f
+#define FASTMATH_PI_4 0.785398163397f
+#define FASTMATH_2_PI 0.636619772368f
+
+// Pi/2 split in three parts: x - k*Pi/2 stays exact for large k
+#define FASTMATH_PI_2_A 1.5703125f
+#define FASTMATH_PI_2_B 4.837512969970703125e-4f
+#define FASTMATH_PI_2_C 7.54978995489188216e-8f
+
+#define FASTMATH_SIN_P0 -1.9515295891e-4f
+#define FASTMATH_SIN_P1  8.3321608736e-3f
+#define FASTMATH_SIN_P2 -1.6666654611e-1f
+
+#define FASTMATH_COS_P0  2.443315711809948e-5f
+#define FASTMATH_COS_P1 -1.388731625493765e-3f
+#define FASTMATH_COS_P2  4.166664568298827e-2f
+
+static inline float fastInvSqrt(float val)
+{
+    union
+    {
+        int tmp;
+        float f;
+    } u;
+    u.f = val;
+    u.tmp = 0x5F375A86 - (u.tmp >> 1);
+    u.f *= 1.5f - 0.5f * val * u.f * u.f; /* Newton steps: error 1.7e-3, then 4.7e-6, then float precision */
+    u.f *= 1.5f - 0.5f * val * u.f * u.f;
+    u.f *= 1.5f - 0.5f * val * u.f * u.f;
+    return u.f;
+}
+
+static inline float fastSqrt(float val)
+{
+#if defined(__arm__) && defined(__VFP_FP__) && !defined(__SOFTFP__)
+    // VFP has a correctly rounded square root
+    float res;
+    __asm__ ("vsqrt.f32 %0, %1" : "=t"(res) : "t"(val));
+    return res;
+#else
+    return (val > 0.f) ? val * fastInvSqrt(val) : 0.f;
+#endif
+}
+
+// Sine and cosine of x in [-Pi/4, Pi/4]
+static inline float fastSinReduced(float x)
+{
+    float z = x * x;
+    return x + x * z * ((FASTMATH_SIN_P0 * z + FASTMATH_SIN_P1) * z + FASTMATH_SIN_P2);
+}
+
+static inline float fastCosReduced(float x)
+{
+    float z = x * x;
+    return 1.f - 0.5f * z + z * z * ((FASTMATH_COS_P0 * z + FASTMATH_COS_P1) * z + FASTMATH_COS_P2);
+}
+
+static inline void fastSinCos(float x, float* oSin, float* oCos)
+{
+    // Nearest multiple of Pi/2 gives the quadrant
+    float kf = x * FASTMATH_2_PI;
+    int k = (int)(kf + ((kf < 0.f) ? -0.5f : 0.5f));
+    kf = (float)k;
+
+    float r = ((x - kf * FASTMATH_PI_2_A) - kf * FASTMATH_PI_2_B) - kf * FASTMATH_PI_2_C;
+    float s = fastSinReduced(r);
+    float c = fastCosReduced(r);
+
+    switch (k & 3)
+    {
+    case 0: *oSin =  s; *oCos =  c; break;
+    case 1: *oSin =  c; *oCos = -s; break;
+    case 2: *oSin = -s; *oCos = -c; break;
+    default: *oSin = -c; *oCos = s; break;
+    }
+}
+
+static inline float fastSin(float x)
+{
+    float s, c;
+    fastSinCos(x, &s, &c);
+    return s;
+}
+
+static inline float fastCos(float x)
+{
+    float s, c;
+    fastSinCos(x, &s, &c);
+    return c;
+}
+
+static inline float fastAtan(float x)
+{
+    float ax = (x < 0.f) ? -x : x;
+    float y = 0.f;
+
+    // tan(3Pi/8) and tan(Pi/8) bounds
+    if (ax > 2.414213562373095f)
+    {
+        y = FASTMATH_PI_2;
+        ax = -1.f / ax;
+    }
+    else if (ax > 0.4142135623730950f)
+    {
+        y = FASTMATH_PI_4;
+        ax = (ax - 1.f) / (ax + 1.f);
+    }
+
+    float z = ax * ax;
+    y += (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z * ax + ax;
+    return (x < 0.f) ? -y : y;
+}
+
+static inline float fastAtan2(float y, float x)
+{
+    if (0.f == x)
+        return (y > 0.f) ? FASTMATH_PI_2 : ((y < 0.f) ? -FASTMATH_PI_2 : 0.f);
+
+    float angle = fastAtan(y / x);
+    if (x < 0.f)
+        angle += (y < 0.f) ? -M_PI : M_PI;
+    return angle;
+}
+
+// Arcsine of x in [0, 0.5]
+static inline float fastAsinReduced(float x)
+{
+    float z = x * x;
+    return ((((4.2163199048e-2f * z + 2.4181311049e-2f) * z + 4.5470025998e-2f) * z + 7.4953002686e-2f) * z + 1.6666752422e-1f) * z * x + x;
+}
+
+static inline float fastAcos(float x)
+{
+    if (x > 1.f)
+        x = 1.f;
+    else if (x < -1.f)
+        x = -1.f;
+
+    // acos(x) = 2 asin(sqrt((1-x)/2)) keeps the polynomial input small near -1 and 1
+    if (x > 0.5f)
+        return 2.f * fastAsinReduced(fastSqrt(0.5f * (1.f - x)));
+    if (x < -0.5f)
+        return M_PI - 2.f * fastAsinReduced(fastSqrt(0.5f * (1.f + x)));
+    return FASTMATH_PI_2 - fastAsinReduced(x);
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+// Same as fastSinCos for 4 values at once
+static inline void fastSinCos4(float32x4_t x, float32x4_t* oSin, float32x4_t* oCos)
+{
+    float32x4_t kf = vmulq_n_f32(x, FASTMATH_2_PI);
+    float32x4_t half = vbslq_f32(vcltq_f32(kf, vdupq_n_f32(0.f)), vdupq_n_f32(-0.5f), vdupq_n_f32(0.5f));
+    int32x4_t k = vcvtq_s32_f32(vaddq_f32(kf, half));
+    kf = vcvtq_f32_s32(k);
+
+    float32x4_t r = vmlsq_n_f32(x, kf, FASTMATH_PI_2_A);
+    r = vmlsq_n_f32(r, kf, FASTMATH_PI_2_B);
+    r = vmlsq_n_f32(r, kf, FASTMATH_PI_2_C);
+
+    float32x4_t z = vmulq_f32(r, r);
+
+    float32x4_t s = vmlaq_n_f32(vdupq_n_f32(FASTMATH_SIN_P1), z, FASTMATH_SIN_P0);
+    s = vmlaq_f32(vdupq_n_f32(FASTMATH_SIN_P2), s, z);
+    s = vmlaq_f32(r, vmulq_f32(r, z), s);
+
+    float32x4_t c = vmlaq_n_f32(vdupq_n_f32(FASTMATH_COS_P1), z, FASTMATH_COS_P0);
+    c = vmlaq_f32(vdupq_n_f32(FASTMATH_COS_P2), c, z);
+    c = vmlaq_f32(vmlsq_n_f32(vdupq_n_f32(1.f), z, 0.5f), vmulq_f32(z, z), c);
+
+    // Odd quadrants swap sine and cosine, quadrants 2 and 3 negate sine, 1 and 2 negate cosine
+    uint32x4_t swap = vtstq_s32(k, vdupq_n_s32(1));
+    uint32x4_t sinNeg = vshlq_n_u32(vandq_u32(vreinterpretq_u32_s32(k), vdupq_n_u32(2)), 30);
+    uint32x4_t cosNeg = vshlq_n_u32(vandq_u32(vreinterpretq_u32_s32(vaddq_s32(k, vdupq_n_s32(1))), vdupq_n_u32(2)), 30);
+
+    float32x4_t sinRes = vbslq_f32(swap, c, s);
+    float32x4_t cosRes = vbslq_f32(swap, s, c);
+    *oSin = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(sinRes), sinNeg));
+    *oCos = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(cosRes), cosNeg));
+}
+
+// Same as fastInvSqrt for 4 values at once: hardware estimate then Newton steps
+static inline float32x4_t fastInvSqrt4(float32x4_t val)
+{
+    float32x4_t res = vrsqrteq_f32(val);
+    res = vmulq_f32(res, vrsqrtsq_f32(vmulq_f32(val, res), res));
+    res = vmulq_f32(res, vrsqrtsq_f32(vmulq_f32(val, res), res));
+    return res;
+}
+
+#endif
+
+#endif
@@ -24,86 +24,54 @@
 #include <psp2/kernel/processmgr.h>
 #include <psp2/kernel/clib.h>
 #include <psp2/kernel/sysmem.h>
+#include <psp2/kernel/threadmgr.h>
+#include <psp2/appmgr.h>
 #include <psp2/motion.h>
+#include <psp2/touch.h>
 #include <taihen.h>
 
-//#include "log.h"
 #include <string.h>
 #include "../DSMotionLibrary.h"
+#include "../DSMotionRing.h"
+#include "../DSMotionTrace.h"
+#include "fastmath.h"
+#include "profiles.h"
+
+/*
+ * Defaults for titles without profile in ux0:data/dsmotion/profiles.txt
+ */
 
 // Comment this define to have smoother orientation (but some movements will be ignored)
 #define EULER_ANGLES
 
-#define abs(val) ((val < 0) ? -val : val)
-#define sign(val) ((val > 0) ? 1 : ((val < 0) ? -1 : 0))
+// Set this define to get sensor records evenly spaced with this period (in microseconds)
+#define SENSOR_RESAMPLING_PERIOD 0
 
-static float fastsqrt(float val)
-{
-    union
-    {
-        int tmp;
-        float f;
-    } u;
-    u.f = val;
-    u.tmp -= 1 << 23; /* Subtract 2^m. */
-    u.tmp >>= 1; /* Divide by 2. */
-    u.tmp += 1 << 29; /* Add ((b + 1) / 2) * 2^m. */
-    return u.f;
-}
+// Touch panel which gets the DS4 touchpad (TOUCH_PANEL_NONE to keep the console panels only)
+#define TOUCH_PANEL TOUCH_PANEL_FRONT
 
-#define M_PI 3.14159265359f
+#undef abs
+#define abs(val) (((val) < 0) ? -(val) : (val))
+#define sign(val) (((val) > 0) ? 1 : (((val) < 0) ? -1 : 0))
 
-static float sine(float x)
-{
-    static float B = 4.f/M_PI;
-    static float C = -4.f/(M_PI*M_PI);
+// Settings of the running title
+static struct motionProfile profile;
 
-    float y = B * x + C * x * abs(x);
+// Hook calls are traced by the kernel plugin when its trace file exists
+static int traceEnabled = 0;
 
-    //  const float Q = 0.775;
-    float P = 0.225f;
-    y = P * (y * abs(y) - y) + y;   // Q * y + P * y * abs(y)
-    return y;
-}
-
-static float cosine(float x)
-{
-    return sine(x + (M_PI / 2.f));
-}
-
-#ifdef EULER_ANGLES
-
-float atan2_approx(float y, float x)
-{
-    static float ONEQTR_PI = M_PI / 4.0;
-	static float THRQTR_PI = 3.0 * M_PI / 4.0;
-	float r, angle;
-	float abs_y = abs(y) + 1e-10f;
-	if ( x < 0.0f )
-	{
-		r = (x + abs_y) / (abs_y - x);
-		angle = THRQTR_PI;
-	}
-	else
-	{
-		r = (x - abs_y) / (x + abs_y);
-		angle = ONEQTR_PI;
-	}
-	angle += (0.1963f * r * r - 0.9817f) * r;
-	if ( y < 0.0f )
-		return -angle;
-
-    return angle;
-}
+#define TRACE(event, arg0, arg1, arg2) \
+    do { \
+        if (traceEnabled) \
+            dsTrace((event), (arg0), (arg1), (arg2)); \
+    } while (0)
 
 static void eulerToQuaternion(SceFQuaternion* quat, float x, float y, float z)
 {
-	float cy = cosine(z * 0.5f);
-	float sy = sine(z * 0.5f);
-	float cr = cosine(y * 0.5f);
-	float sr = sine(y * 0.5f);
-	float cp = cosine(x * 0.5f);
-	float sp = sine(x * 0.5f);
+	float cy, sy, cr, sr, cp, sp;
+	fastSinCos(z * 0.5f, &sy, &cy);
+	fastSinCos(y * 0.5f, &sr, &cr);
+	fastSinCos(x * 0.5f, &sp, &cp);
 
 	quat->w = cy * cr * cp + sy * sr * sp;
 	quat->x = cy * sr * cp - sy * cr * sp;
@@ -111,21 +79,6 @@ static void eulerToQuaternion(SceFQuaternion* quat, float x, float y, float z)
 	quat->z = sy * cr * cp - cy * sr * sp;
 }
 
-#else
-
-static float arccosine(float x)
-{
-    float a=1.43f+0.59f*x;
-    a=(a+(2.f+2.f*x)/a)/2.f;
-    float b=1.65f-1.41f*x;
-    b=(b+(2.f-2.f*x)/b)/2.f;
-    float c=0.88f-0.77f*x;
-    c=(c+(2.f-a)/c)/2.f;
-    return 8.f/3.f*c-b/3.f;
-}
-
-#endif
-
 /*static void quaternionProduct(SceFQuaternion* res, SceFQuaternion* q1, SceFQuaternion* q2)
 {
     res->w = q1->w*q2->w - q1->x*q2->x - q1->y*q2->y - q1->z*q2->z;
@@ -136,44 +89,541 @@ static float arccosine(float x)
 
 static int computeQuaternionFromAccel(SceFQuaternion* oRes, SceFVector3* iAccel)
 {
-    float accelNorm = fastsqrt(iAccel->x*iAccel->x + iAccel->y*iAccel->y + iAccel->z*iAccel->z);
+    float accelNorm = fastSqrt(iAccel->x*iAccel->x + iAccel->y*iAccel->y + iAccel->z*iAccel->z);
     if (accelNorm < 0.001f)
         return 0;
 
     SceFVector3 normAccel = { iAccel->x / accelNorm , iAccel->y / accelNorm , iAccel->z / accelNorm };
     
-#ifdef EULER_ANGLES
-    float pitch = atan2_approx(normAccel.z, -normAccel.y);
-    float roll = atan2_approx(-normAccel.x, -normAccel.z*sign(-pitch));
+    if (profile.eulerAngles)
+    {
+        float pitch = fastAtan2(normAccel.z, -normAccel.y);
+        float roll = fastAtan2(-normAccel.x, -normAccel.z*sign(-pitch));
+
+        eulerToQuaternion(oRes, 0.f, pitch, roll);
+        return 1;
+    }
 
-    eulerToQuaternion(oRes, 0.f, pitch, roll);
-#else
     static SceFVector3 initDir = {0.f, -1.f, 0.f};
     
     oRes->x = initDir.z*normAccel.y - initDir.y*normAccel.z;
     oRes->y = initDir.x*normAccel.z - initDir.z*normAccel.x;
     oRes->z = initDir.y*normAccel.x - initDir.x*normAccel.y;
     
-    float angle = arccosine(initDir.x*normAccel.x + initDir.y*normAccel.y + initDir.z*normAccel.z);
-    float half_sin = sine(0.5f * angle);
-    float half_cos = cosine(0.5f * angle);
+    float angle = fastAcos(initDir.x*normAccel.x + initDir.y*normAccel.y + initDir.z*normAccel.z);
+    float half_sin, half_cos;
+    fastSinCos(0.5f * angle, &half_sin, &half_cos);
     oRes->w = half_cos;
     
-    float crossNorm = fastsqrt(oRes->x*oRes->x + oRes->y*oRes->y + oRes->z*oRes->z);
+    float crossNorm = fastSqrt(oRes->x*oRes->x + oRes->y*oRes->y + oRes->z*oRes->z);
     oRes->x *= half_sin / crossNorm;
     oRes->y *= half_sin / crossNorm;
     oRes->z *= half_sin / crossNorm;
-#endif
     
     return 1;
 }
 
+/*
+ * Mahony complementary filter: gyroscope is integrated on each sample and
+ * accelerometer slowly pulls the orientation back to gravity direction.
+ * Its integral term tracks the gyroscope bias.
+ */
+
+#define FUSION_KP 1.f
+#define FUSION_KI 0.05f
+#define FUSION_MAX_DELTA_TIME 0.1f
+
+static SceFQuaternion fusionQuat = {0.f, 0.f, 0.f, 1.f};
+static SceFVector3 fusionGyroBias = {0.f, 0.f, 0.f};
+static unsigned int fusionCounter = 0;
+static unsigned int fusionTimestamp = 0;
+static int fusionReady = 0;
+
+// Acceleration is in units of the controller: iOneG is its gravity norm
+static void fusionUpdate(const SceFVector3* iAccel, const SceFVector3* iGyro, float iOneG, float iDeltaTime)
+{
+    SceFQuaternion* q = &fusionQuat;
+
+    float gx = iGyro->x;
+    float gy = iGyro->y;
+    float gz = iGyro->z;
+
+    // Accelerometer correction is skipped when the controller is shaken (far from 1G)
+    float accelSqNorm = iAccel->x*iAccel->x + iAccel->y*iAccel->y + iAccel->z*iAccel->z;
+    float sqOneG = iOneG * iOneG;
+    if (accelSqNorm > 0.5f * sqOneG && accelSqNorm < 1.5f * sqOneG)
+    {
+        float invNorm = fastInvSqrt(accelSqNorm);
+        float ax = iAccel->x * invNorm;
+        float ay = iAccel->y * invNorm;
+        float az = iAccel->z * invNorm;
+
+        // Expected gravity direction {0, -1, 0} in device frame
+        float vx = -2.f * (q->x*q->y + q->w*q->z);
+        float vy = -(q->w*q->w - q->x*q->x + q->y*q->y - q->z*q->z);
+        float vz = -2.f * (q->y*q->z - q->w*q->x);
+
+        float ex = ay*vz - az*vy;
+        float ey = az*vx - ax*vz;
+        float ez = ax*vy - ay*vx;
+
+        fusionGyroBias.x += FUSION_KI * ex * iDeltaTime;
+        fusionGyroBias.y += FUSION_KI * ey * iDeltaTime;
+        fusionGyroBias.z += FUSION_KI * ez * iDeltaTime;
+
+        gx += FUSION_KP * ex + fusionGyroBias.x;
+        gy += FUSION_KP * ey + fusionGyroBias.y;
+        gz += FUSION_KP * ez + fusionGyroBias.z;
+    }
+
+    float halfDt = 0.5f * iDeltaTime;
+    float qw = q->w;
+    float qx = q->x;
+    float qy = q->y;
+    float qz = q->z;
+
+    q->w += halfDt * (-qx*gx - qy*gy - qz*gz);
+    q->x += halfDt * ( qw*gx + qy*gz - qz*gy);
+    q->y += halfDt * ( qw*gy - qx*gz + qz*gx);
+    q->z += halfDt * ( qw*gz + qx*gy - qy*gx);
+
+    float invNorm = fastInvSqrt(q->w*q->w + q->x*q->x + q->y*q->y + q->z*q->z);
+    q->w *= invNorm;
+    q->x *= invNorm;
+    q->y *= invNorm;
+    q->z *= invNorm;
+}
+
+/*
+ * Conversion from controller data to SceMotion axis: one entry per output component
+ * (acceleration x, y, z then angular velocity x, y, z) gives the source component
+ * in accelGyroData (accel[0..2] then gyro[0..2]) and its scale with sign.
+ */
+struct axisMapping
+{
+    unsigned char source;
+    float scale;
+};
+
+#define ACCEL_SCALE (1.f / 0x2000)
+#define GYRO_SCALE (1.f / 2607.6f) // 2607.6 = 0x2000 / PI
+
+// Default mapping: pitch, roll and yaw are gyroscope x, -z and y
+static const unsigned char defaultAxisSource[AXIS_SOURCE_COUNT] = {2, 0, 1, 3, 5, 4};
+static const signed char defaultAxisSign[AXIS_SOURCE_COUNT] = {-1, 1, -1, 1, -1, 1};
+
+static struct axisMapping axisTable[AXIS_SOURCE_COUNT];
+
+static void setAxisTable(const struct motionProfile* iProfile)
+{
+    for (int i = 0 ; i < AXIS_SOURCE_COUNT ; i++)
+    {
+        unsigned char source = iProfile->axisSource[i];
+        if (source >= AXIS_SOURCE_COUNT)
+            source = defaultAxisSource[i];
+
+        axisTable[i].source = source;
+        axisTable[i].scale = ((source < 3) ? ACCEL_SCALE : GYRO_SCALE) * ((iProfile->axisSign[i] < 0) ? -1.f : 1.f);
+    }
+}
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+
+#include <arm_neon.h>
+
+// Byte shuffle of the 6 components (and 2 padding lanes) and matching scales
+static unsigned char axisShuffle[16];
+static float axisScale[8];
+
+static void initAxisConversion()
+{
+    for (int i = 0 ; i < 8 ; i++)
+    {
+        unsigned char source = (i < 6) ? axisTable[i].source : 0;
+        axisShuffle[2*i] = 2*source;
+        axisShuffle[2*i+1] = 2*source+1;
+        axisScale[i] = (i < 6) ? axisTable[i].scale : 0.f;
+    }
+}
+
+/*
+ * Converts a block of samples into SceMotion vectors: acceleration then angular velocity
+ * are written as 6 consecutive floats at "oValues", moving by "iStride" bytes for each sample.
+ */
+static void convertAccelGyro(const struct accelGyroData* iData, int iCount, float* oValues, unsigned int iStride)
+{
+    uint8x8_t shuffleLow = vld1_u8(&axisShuffle[0]);
+    uint8x8_t shuffleHigh = vld1_u8(&axisShuffle[8]);
+    float32x4_t scaleLow = vld1q_f32(&axisScale[0]);
+    float32x4_t scaleHigh = vld1q_f32(&axisScale[4]);
+
+    for (int i = 0 ; i < iCount ; i++)
+    {
+        uint8x16_t raw = vreinterpretq_u8_s16(vld1q_s16((const int16_t*)&iData[i]));
+        uint8x8x2_t bytes = {{vget_low_u8(raw), vget_high_u8(raw)}};
+
+        int16x4_t low = vreinterpret_s16_u8(vtbl2_u8(bytes, shuffleLow));
+        int16x4_t high = vreinterpret_s16_u8(vtbl2_u8(bytes, shuffleHigh));
+
+        float32x4_t valuesLow = vmulq_f32(vcvtq_f32_s32(vmovl_s16(low)), scaleLow);
+        float32x4_t valuesHigh = vmulq_f32(vcvtq_f32_s32(vmovl_s16(high)), scaleHigh);
+
+        vst1q_f32(oValues, valuesLow);
+        vst1_f32(oValues+4, vget_low_f32(valuesHigh));
+
+        oValues = (float*)((char*)oValues + iStride);
+    }
+}
+
+#else
+
+static void initAxisConversion()
+{
+}
+
+static void convertAccelGyro(const struct accelGyroData* iData, int iCount, float* oValues, unsigned int iStride)
+{
+    for (int i = 0 ; i < iCount ; i++)
+    {
+        const signed short* raw = iData[i].accel; // accel then gyro are consecutive
+
+        for (int j = 0 ; j < 6 ; j++)
+            oValues[j] = (float)raw[axisTable[j].source] * axisTable[j].scale;
+
+        oValues = (float*)((char*)oValues + iStride);
+    }
+}
+
+#endif
+
+#define MAX_SENSOR_RECORDS 64
+
+/*
+ * Sample rings are read directly from the kernel plugin shared memory when it is
+ * available, which avoids a system call per read. Kernel exports are the fallback.
+ */
+static const struct dsSharedMemory* sharedMemory = NULL;
+static SceUID processId = 0;
+
+static void sharedOpen()
+{
+    // Same layout only: ring sizes may have been changed at build time
+    const struct dsSharedMemory* shared = dsGetSharedMemory();
+    if (NULL != shared && sceKernelFindMemBlockByAddr(shared, 0) >= 0 && DS_SHARED_VERSION == shared->version
+        && sizeof(struct dsSharedMemory) == shared->size && DS_HISTORY_SIZE == shared->historySize
+        && DS_TOUCH_HISTORY_SIZE == shared->touchHistorySize)
+        sharedMemory = shared;
+    processId = sceKernelGetProcessId();
+}
+
+static const struct dsSharedDevice* getPrimaryRing()
+{
+    int primary = sharedMemory->primaryDevice;
+    if (primary < 0 || primary >= DS_MAX_DEVICES)
+        return NULL;
+
+    const struct dsSharedDevice* ring = &sharedMemory->devices[primary];
+    return (DS_DEVICE_NONE != ring->type) ? ring : NULL;
+}
+
+static unsigned int getCurrentTimestamp()
+{
+    return (NULL != sharedMemory) ? sceKernelGetSystemTimeLow() : dsGetCurrentTimestamp();
+}
+
+static int getPrimaryType()
+{
+    if (NULL == sharedMemory)
+        return dsGetDeviceType(DS_PRIMARY_DEVICE);
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    return (NULL != ring) ? ring->type : DS_DEVICE_NONE;
+}
+
+static unsigned int getCurrentCounter()
+{
+    if (NULL == sharedMemory)
+        return dsGetCurrentCounter();
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    return (NULL != ring) ? ring->counter : 0;
+}
+
+// Device index and connection of the primary controller (generations are unique across devices)
+static void getPrimaryConnection(unsigned int* oDevice, unsigned int* oGeneration)
+{
+    if (NULL == sharedMemory)
+    {
+        *oDevice = DS_PRIMARY_DEVICE;
+        *oGeneration = dsGetDeviceGeneration(DS_PRIMARY_DEVICE);
+        return;
+    }
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    *oDevice = (NULL != ring) ? ring - sharedMemory->devices : DS_PRIMARY_DEVICE;
+    *oGeneration = (NULL != ring) ? ring->generation : 0;
+}
+
+// Filter is the one this process set in the kernel plugin
+static int getFilteredAccelGyro(signed short oAccel[3], signed short oGyro[3])
+{
+    if (NULL == sharedMemory)
+        return dsGetFilteredAccelGyro(oAccel, oGyro) > 0;
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    unsigned int lastCounter;
+    return (NULL != ring) ? dsReadFiltered(sharedMemory, processId, ring - sharedMemory->devices, oAccel, oGyro, &lastCounter) > 0 : 0;
+}
+
+static int getAccelGyroHistory(unsigned int iStart, unsigned int iCount, struct accelGyroData* oData)
+{
+    if (NULL == sharedMemory)
+        return dsGetAccelGyroHistory(iStart, iCount, oData);
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    return (NULL != ring) ? dsReadHistory(ring, iStart, iCount, oData) : 0;
+}
+
+/*
+ * Kernel plugin fuses each sample as soon as it arrives, in default axes only:
+ * titles with another axis mapping use the fusion filter of this plugin.
+ */
+static int kernelOrientation = 0;
+
+#define ORIENTATION_SCALE (1.f / DS_ORIENTATION_ONE)
+
+static int getOrientation(SceFQuaternion* oQuat)
+{
+    struct dsQuaternion quat;
+    if (NULL != sharedMemory)
+    {
+        const struct dsSharedDevice* ring = getPrimaryRing();
+        unsigned int lastCounter;
+        if (NULL == ring || dsReadOrientation(ring, &quat, &lastCounter) <= 0)
+            return 0;
+    }
+    else
+    {
+        struct dsOrientation orientation;
+        if (dsGetOrientation(&orientation) <= 0)
+            return 0;
+        quat = orientation.quat;
+    }
+
+    oQuat->x = (float)quat.x * ORIENTATION_SCALE;
+    oQuat->y = (float)quat.y * ORIENTATION_SCALE;
+    oQuat->z = (float)quat.z * ORIENTATION_SCALE;
+    oQuat->w = (float)quat.w * ORIENTATION_SCALE;
+    return 1;
+}
+
+// Each new sample is given exactly once to the fusion filter
+static void fusionConsumeSamples()
+{
+    unsigned int lastCounter = getCurrentCounter();
+
+    // Counter is reset by the kernel plugin on controller connection
+    if (lastCounter < fusionCounter)
+        fusionCounter = 0;
+
+    unsigned int nbNew = lastCounter - fusionCounter;
+    if (0 == nbNew)
+        return;
+
+    if (nbNew > MAX_SENSOR_RECORDS)
+        nbNew = MAX_SENSOR_RECORDS;
+
+    struct accelGyroData history[MAX_SENSOR_RECORDS];
+    int nbData = getAccelGyroHistory(0, nbNew, history);
+
+    // DS3 samples are not scaled to 1G
+    float oneG = (DS_DEVICE_DS3 == getPrimaryType()) ? DS_ACCEL_ONE_G_DS3 * ACCEL_SCALE : 1.f;
+
+    for (int i = 0 ; i < nbData ; i++)
+    {
+        struct accelGyroData* data = &history[i];
+        if (data->counter <= fusionCounter)
+            continue;
+
+        SceFVector3 values[2];
+        convertAccelGyro(data, 1, (float*)values, 0);
+        SceFVector3* accel = &values[0];
+        SceFVector3* gyro = &values[1];
+
+        float deltaTime = (float)(data->timestamp - fusionTimestamp) * 0.000001f;
+        if (fusionReady && deltaTime <= FUSION_MAX_DELTA_TIME)
+            fusionUpdate(accel, gyro, oneG, deltaTime);
+        else
+            fusionReady = computeQuaternionFromAccel(&fusionQuat, accel);  // Initial alignment or too long gap
+
+        fusionTimestamp = data->timestamp;
+        fusionCounter = data->counter;
+    }
+}
+
 static float identityMat[16] = {1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 1.f};
 static SceFQuaternion identityQuat = {0.f, 0.f, 0.f, 1.f};
 
 static unsigned int initTimestamp;
 static unsigned int initCounter;
 
+// Smoothing of sceMotionGetState values (box filter of 100ms is the historical behavior)
+#define STATE_FILTER_TYPE DS_FILTER_BOX
+#define STATE_FILTER_TIME_US 100000
+#define STATE_FILTER_MIN_CUTOFF_MHZ 1000
+#define STATE_FILTER_BETA 200
+
+/*
+ * Last computed motion state, reused as long as no new sample has arrived on the same connection:
+ * counters start over when a controller connects. Hits and misses are traced periodically and on module stop,
+ * titles seldom unloading the plugin.
+ */
+static SceMotionState cachedState;
+static unsigned int cachedDevice = DS_PRIMARY_DEVICE;
+static unsigned int cachedGeneration = 0;
+static unsigned int cachedCounter = 0;
+static struct dsFilterParams cachedFilter;
+static unsigned int stateCacheHits = 0;
+static unsigned int stateCacheMisses = 0;
+
+// Only values computed from the samples: times and reserved fields are the ones of this call
+static void copyComputedState(const SceMotionState* iState, SceMotionState* oState)
+{
+    oState->acceleration = iState->acceleration;
+    oState->angularVelocity = iState->angularVelocity;
+    oState->deviceQuat = iState->deviceQuat;
+    oState->rotationMatrix = iState->rotationMatrix;
+    oState->nedMatrix = iState->nedMatrix;
+    oState->basicOrientation = iState->basicOrientation;
+}
+
+/*
+ * Converted records of the primary controller, from the oldest to the most recent one:
+ * only the samples this process hasn't read yet are retrieved and converted.
+ */
+static SceMotionSensorState sensorRecords[MAX_SENSOR_RECORDS];
+static int nbSensorRecords = 0;
+static unsigned int sensorLostSamples = 0;
+
+static void traceStateCache()
+{
+    if (0 == (stateCacheHits + stateCacheMisses) % DS_TRACE_STATE_CACHE_PERIOD)
+        TRACE(DS_TRACE_STATE_CACHE, stateCacheHits, stateCacheMisses, sensorLostSamples);
+}
+
+static void updateSensorRecords()
+{
+    struct accelGyroData newData[MAX_SENSOR_RECORDS];
+    unsigned int lost = 0;
+    int nbNew = dsGetNewAccelGyro(MAX_SENSOR_RECORDS, newData, &lost);
+    sensorLostSamples += lost;
+    if (nbNew <= 0)
+        return;
+
+    int nbKept = MAX_SENSOR_RECORDS-nbNew;
+    if (nbKept > nbSensorRecords)
+        nbKept = nbSensorRecords;
+
+    memmove(sensorRecords, &sensorRecords[nbSensorRecords-nbKept], nbKept*sizeof(SceMotionSensorState));
+    nbSensorRecords = nbKept+nbNew;
+
+    SceMotionSensorState* newRecords = &sensorRecords[nbKept];
+    convertAccelGyro(newData, nbNew, &newRecords[0].accelerometer.x, sizeof(SceMotionSensorState));
+
+    for (int i = 0 ; i < nbNew ; i++)
+    {
+        newRecords[i].timestamp = newData[i].timestamp - initTimestamp;
+        newRecords[i].counter = newData[i].counter - initCounter;
+    }
+}
+
+/*
+ * DS4 touchpad replaces the chosen touch panel while a finger is on it: each buffer filled by
+ * SceTouch gets the touchpad state at its own time, all from a single batched read of the touch ring.
+ */
+#define MAX_TOUCH_RECORDS 64
+
+#define TOUCH_PANEL_WIDTH 1920
+#define TOUCH_FRONT_MIN_Y 0
+#define TOUCH_FRONT_MAX_Y 1088
+#define TOUCH_BACK_MIN_Y 108
+#define TOUCH_BACK_MAX_Y 889
+
+// Touchpad states older than a few report intervals are stale (controller gone or out of range)
+#define TOUCH_REPORT_PERIOD_US 4000
+#define TOUCH_MAX_AGE_US (4 * TOUCH_REPORT_PERIOD_US)
+
+static SceInt64 touchTimeOffset = 0; // Process time minus system time
+
+static int getTouchHistory(unsigned int iCount, struct dsTouchData* oData)
+{
+    if (NULL == sharedMemory)
+        return dsGetTouchHistory(iCount, oData);
+
+    const struct dsSharedDevice* ring = getPrimaryRing();
+    return (NULL != ring) ? dsReadTouchHistory(ring, iCount, oData) : 0;
+}
+
+static void convertTouch(const struct dsTouchData* iTouch, SceTouchData* oData)
+{
+    int minY = (TOUCH_PANEL_BACK == profile.touchPanel) ? TOUCH_BACK_MIN_Y : TOUCH_FRONT_MIN_Y;
+    int maxY = (TOUCH_PANEL_BACK == profile.touchPanel) ? TOUCH_BACK_MAX_Y : TOUCH_FRONT_MAX_Y;
+
+    int nbReports = 0;
+    for (int i = 0 ; i < DS_TOUCH_MAX_FINGERS ; i++)
+    {
+        const struct dsTouchFinger* finger = &iTouch->fingers[i];
+        if (!finger->active)
+            continue;
+
+        SceTouchReport* report = &oData->report[nbReports++];
+        memset(report, 0, sizeof(SceTouchReport));
+        report->id = finger->id;
+        report->force = 128;
+        report->x = finger->x * TOUCH_PANEL_WIDTH / DS_TOUCH_WIDTH;
+        report->y = minY + finger->y * (maxY - minY) / DS_TOUCH_HEIGHT;
+    }
+
+    // Console panel is kept while the touchpad isn't touched
+    if (0 == nbReports)
+        return;
+
+    oData->reportNum = nbReports;
+    oData->timeStamp = iTouch->timestamp + touchTimeOffset;
+}
+
+static void forwardTouch(SceUInt32 iPort, SceTouchData* ioData, int iNbBufs)
+{
+    if (iPort != profile.touchPanel || iNbBufs <= 0)
+        return;
+
+    // DS4 reports come about 4 times per frame
+    unsigned int count = iNbBufs * 8;
+    if (count > MAX_TOUCH_RECORDS)
+        count = MAX_TOUCH_RECORDS;
+
+    struct dsTouchData touches[MAX_TOUCH_RECORDS];
+    int nbTouches = getTouchHistory(count, touches);
+    TRACE(DS_TRACE_TOUCH, iPort, iNbBufs, nbTouches);
+    if (nbTouches <= 0)
+        return;
+
+    // Buffers and touch states are both from the oldest to the most recent one
+    int touch = nbTouches-1;
+    for (int i = iNbBufs-1 ; i >= 0 ; i--)
+    {
+        SceUInt64 time = (0 != ioData[i].timeStamp) ? ioData[i].timeStamp : sceKernelGetProcessTimeWide();
+        while (touch > 0 && touches[touch].timestamp + touchTimeOffset > time)
+            touch--;
+
+        // Real panel is kept when the touchpad has nothing recent for this buffer
+        if (touches[touch].timestamp + touchTimeOffset + TOUCH_MAX_AGE_US < time)
+            continue;
+
+        convertTouch(&touches[touch], &ioData[i]);
+    }
+}
+
 #define DECL_FUNC_HOOK(name, ...) \
 	static tai_hook_ref_t name##_ref; \
 	static SceUID name##_hook_uid = -1; \
@@ -184,9 +634,11 @@ DECL_FUNC_HOOK(SceMotion_sceMotionStartSampling)
 	int ret = TAI_CONTINUE(int, SceMotion_sceMotionStartSampling_ref);
     if (ret >= 0)
     {
-        initTimestamp = dsGetCurrentTimestamp();
-        initCounter = dsGetCurrentCounter();
+        initTimestamp = getCurrentTimestamp();
+        initCounter = getCurrentCounter();
+        nbSensorRecords = 0;
     }
+    TRACE(DS_TRACE_START_SAMPLING, ret, initCounter, 0);
     return ret;
 }
 
@@ -199,28 +651,57 @@ DECL_FUNC_HOOK(SceMotion_sceMotionGetState, SceMotionState *motionState)
         signed short accel[3];
         signed short gyro[3];
 
-        if (dsGetSampledAccelGyro(100, accel, gyro) > 0)
+        unsigned int device;
+        unsigned int generation;
+        getPrimaryConnection(&device, &generation);
+        unsigned int lastCounter = getCurrentCounter();
+        if (0 != lastCounter && lastCounter == cachedCounter && device == cachedDevice && generation == cachedGeneration
+            && 0 == memcmp(&cachedFilter, &profile.filter, sizeof(profile.filter)))
         {
+            stateCacheHits++;
+            traceStateCache();
+            copyComputedState(&cachedState, motionState);
             motionState->hostTimestamp = sceKernelGetProcessTimeWide();
+            TRACE(DS_TRACE_GET_STATE, ret, lastCounter, 1);
+            return ret;
+        }
+        stateCacheMisses++;
+        traceStateCache();
 
-            motionState->acceleration.x = -(float)accel[2] / 0x2000;
-            motionState->acceleration.y = (float)accel[0] / 0x2000;
-            motionState->acceleration.z = -(float)accel[1] / 0x2000;
+        if (ORIENTATION_FUSION == profile.orientation && !kernelOrientation)
+            fusionConsumeSamples();
 
-            // 2607.6 = 0x2000 / PI
-            motionState->angularVelocity.x = (float)gyro[0] / 2607.6f;  // Pitch
-            motionState->angularVelocity.y = -(float)gyro[2] / 2607.6f; // Roll
-            motionState->angularVelocity.z = (float)gyro[1] / 2607.6f;  // Yaw
-            
-            int maxComp = (abs(accel[1]) > abs(accel[0])) ? 1 : 0;
-            maxComp = (abs(accel[2]) > abs(accel[maxComp])) ? 2 : maxComp;
+        if (getFilteredAccelGyro(accel, gyro) > 0)
+        {
+            motionState->hostTimestamp = sceKernelGetProcessTimeWide();
 
-            motionState->basicOrientation.x = (2 == maxComp) ? sign(accel[2]) : 0.f;
-            motionState->basicOrientation.y = (0 == maxComp) ? -sign(accel[0]) : 0.f;
-            motionState->basicOrientation.z = (1 == maxComp) ? sign(accel[1]) : 0.f;
+            struct accelGyroData sampled = {{accel[0], accel[1], accel[2]}, {gyro[0], gyro[1], gyro[2]}, 0, 0};
+            convertAccelGyro(&sampled, 1, &motionState->acceleration.x, 0);
+
+            // Axis the gravity is mostly along, in the axes of the title profile
+            const SceFVector3* gravity = &motionState->acceleration;
+            int maxComp = (abs(gravity->y) > abs(gravity->x)) ? 1 : 0;
+            maxComp = (abs(gravity->z) > abs((0 == maxComp) ? gravity->x : gravity->y)) ? 2 : maxComp;
+
+            motionState->basicOrientation.x = (0 == maxComp) ? -sign(gravity->x) : 0.f;
+            motionState->basicOrientation.y = (1 == maxComp) ? -sign(gravity->y) : 0.f;
+            motionState->basicOrientation.z = (2 == maxComp) ? -sign(gravity->z) : 0.f;
+
+            // Tilt only orientation comes from the smoothed gravity
+            int hasQuat = 0;
+            if (ORIENTATION_TILT == profile.orientation)
+                hasQuat = computeQuaternionFromAccel(&motionState->deviceQuat, &motionState->acceleration);
+            else if (kernelOrientation)
+                hasQuat = getOrientation(&motionState->deviceQuat);
+            else if (fusionReady)
+            {
+                memcpy(&motionState->deviceQuat, &fusionQuat, sizeof(fusionQuat));
+                hasQuat = 1;
+            }
 
-            if (computeQuaternionFromAccel(&motionState->deviceQuat, &motionState->acceleration))
+            if (hasQuat)
             {
+
                 float sqx = motionState->deviceQuat.x*motionState->deviceQuat.x;
                 float sqy = motionState->deviceQuat.y*motionState->deviceQuat.y;
                 float sqz = motionState->deviceQuat.z*motionState->deviceQuat.z;
@@ -257,7 +738,15 @@ DECL_FUNC_HOOK(SceMotion_sceMotionGetState, SceMotionState *motionState)
             }
             
             memcpy(&motionState->nedMatrix, identityMat, sizeof(identityMat));
+
+            copyComputedState(motionState, &cachedState);
+            cachedDevice = device;
+            cachedGeneration = generation;
+            cachedCounter = lastCounter;
+            cachedFilter = profile.filter;
         }
+
+        TRACE(DS_TRACE_GET_STATE, ret, lastCounter, 0);
     }
 
     return ret;
@@ -268,30 +757,59 @@ DECL_FUNC_HOOK(SceMotion_sceMotionGetSensorState, SceMotionSensorState *sensorSt
 	int ret = TAI_CONTINUE(int, SceMotion_sceMotionGetSensorState_ref, sensorState, numRecords);
     if (ret >= 0 && NULL != sensorState)
     {
-        struct accelGyroData data;
-        for (int i = 0 ; i < numRecords ; i++)
+        if (numRecords > MAX_SENSOR_RECORDS)
+            numRecords = MAX_SENSOR_RECORDS;
+
+        int nbData;
+        unsigned int period = profile.resamplingPeriod;
+        if (0 != period)
         {
-            if (dsGetInstantAccelGyro(numRecords-1-i, &data) >= 0)
-            {
-                SceMotionSensorState* curState = &sensorState[i];
+            struct accelGyroData history[MAX_SENSOR_RECORDS];
+            nbData = dsGetDeviceResampledAccelGyro(DS_PRIMARY_DEVICE, period, numRecords, history);
+            int firstRecord = numRecords-nbData;
 
-                curState->accelerometer.x = -(float)data.accel[2] / 0x2000;
-                curState->accelerometer.y = (float)data.accel[0] / 0x2000;
-                curState->accelerometer.z = -(float)data.accel[1] / 0x2000;
+            if (nbData > 0)
+                convertAccelGyro(history, nbData, &sensorState[firstRecord].accelerometer.x, sizeof(SceMotionSensorState));
 
-                // 2608.6 = 0x2000 / PI
-                curState->gyro.x = (float)data.gyro[0] / 2607.6f;
-                curState->gyro.y = -(float)data.gyro[2] / 2608.6f;
-                curState->gyro.z = (float)data.gyro[1] / 2608.6f;
+            for (int i = 0 ; i < nbData ; i++)
+            {
+                struct accelGyroData* data = &history[i];
+                SceMotionSensorState* curState = &sensorState[firstRecord+i];
 
-                curState->timestamp = data.timestamp - initTimestamp;
-                curState->counter = data.counter - initCounter;
+                curState->timestamp = data->timestamp - initTimestamp;
+                curState->counter = curState->timestamp / period;
             }
         }
+        else
+        {
+            updateSensorRecords();
+
+            nbData = (numRecords < nbSensorRecords) ? numRecords : nbSensorRecords;
+            if (nbData > 0)
+                memcpy(&sensorState[numRecords-nbData], &sensorRecords[nbSensorRecords-nbData], nbData*sizeof(SceMotionSensorState));
+        }
+
+        TRACE(DS_TRACE_GET_SENSOR_STATE, ret, numRecords, nbData);
     }
     return ret;
 }
 
+DECL_FUNC_HOOK(SceTouch_sceTouchRead, SceUInt32 port, SceTouchData *pData, SceUInt32 nBufs)
+{
+	int ret = TAI_CONTINUE(int, SceTouch_sceTouchRead_ref, port, pData, nBufs);
+    if (ret > 0 && NULL != pData)
+        forwardTouch(port, pData, ret);
+    return ret;
+}
+
+DECL_FUNC_HOOK(SceTouch_sceTouchPeek, SceUInt32 port, SceTouchData *pData, SceUInt32 nBufs)
+{
+	int ret = TAI_CONTINUE(int, SceTouch_sceTouchPeek_ref, port, pData, nBufs);
+    if (ret > 0 && NULL != pData)
+        forwardTouch(port, pData, ret);
+    return ret;
+}
+
 void _start() __attribute__ ((weak, alias ("module_start")));
 
 #define BIND_FUNC_IMPORT_HOOK(name, module_nid, lib_nid, func_nid) \
@@ -299,20 +817,47 @@ void _start() __attribute__ ((weak, alias ("module_start")));
 
 int module_start(SceSize argc, const void *args)
 {
-    //log_reset();
-    //LOG("Starting module\n");
+    struct motionProfile defaultProfile = {{STATE_FILTER_TYPE, STATE_FILTER_TIME_US, STATE_FILTER_MIN_CUTOFF_MHZ, STATE_FILTER_BETA}};
+    memcpy(defaultProfile.axisSource, defaultAxisSource, sizeof(defaultAxisSource));
+    memcpy(defaultProfile.axisSign, defaultAxisSign, sizeof(defaultAxisSign));
+    defaultProfile.orientation = ORIENTATION_FUSION;
+#ifdef EULER_ANGLES
+    defaultProfile.eulerAngles = 1;
+#endif
+    defaultProfile.resamplingPeriod = SENSOR_RESAMPLING_PERIOD;
+    defaultProfile.touchPanel = TOUCH_PANEL;
+
+    char titleId[12] = {0};
+    if (sceAppMgrAppParamGetString(0, 12, titleId, sizeof(titleId)) < 0)
+        titleId[0] = 0;
+    loadProfile(titleId, &defaultProfile, &profile);
+
+    setAxisTable(&profile);
+    kernelOrientation = (0 == memcmp(profile.axisSource, defaultAxisSource, sizeof(defaultAxisSource))
+                      && 0 == memcmp(profile.axisSign, defaultAxisSign, sizeof(defaultAxisSign)));
+    initAxisConversion();
+    sharedOpen();
+
+    // Filters are updated by the kernel plugin for each process: this title gets the one of its profile
+    dsSetFilter(&profile.filter);
+
+    // Both clocks run at the same rate: touch times only need this difference
+    touchTimeOffset = (SceInt64)(sceKernelGetProcessTimeWide() - sceKernelGetSystemTimeWide());
 
     /* SceMotion hooks */
     BIND_FUNC_IMPORT_HOOK(SceMotion_sceMotionStartSampling, TAI_MAIN_MODULE, 0xDC571B3F, 0x28034AC9);
-    //LOG("sceMotionStartSampling hook result: %x\n", SceMotion_sceMotionStartSampling_hook_uid);
-
     BIND_FUNC_IMPORT_HOOK(SceMotion_sceMotionGetState, TAI_MAIN_MODULE, 0xDC571B3F, 0xBDB32767);
-    //LOG("sceMotionGetState hook result: %x\n", SceMotion_sceMotionGetState_hook_uid);
-
     BIND_FUNC_IMPORT_HOOK(SceMotion_sceMotionGetSensorState, TAI_MAIN_MODULE, 0xDC571B3F, 0x47D679EA);
-    //LOG("sceMotionGetSensorState hook result: %x\n", SceMotion_sceMotionGetSensorState_hook_uid);
 
-    //log_flush();
+    /* SceTouch hooks */
+    if (TOUCH_PANEL_NONE != profile.touchPanel)
+    {
+        BIND_FUNC_IMPORT_HOOK(SceTouch_sceTouchRead, TAI_MAIN_MODULE, 0x3E4F4A81, 0x169A1D58);
+        BIND_FUNC_IMPORT_HOOK(SceTouch_sceTouchPeek, TAI_MAIN_MODULE, 0x3E4F4A81, 0xFF082DF0);
+    }
+
+    traceEnabled = (dsTrace(DS_TRACE_USER_START, SceMotion_sceMotionStartSampling_hook_uid,
+                            SceMotion_sceMotionGetState_hook_uid, SceMotion_sceMotionGetSensorState_hook_uid) >= 0);
 
     return SCE_KERNEL_START_SUCCESS;
 }
@@ -329,8 +874,10 @@ int module_stop(SceSize argc, const void *args)
 	UNBIND_FUNC_HOOK(SceMotion_sceMotionStartSampling);
 	UNBIND_FUNC_HOOK(SceMotion_sceMotionGetState);
     UNBIND_FUNC_HOOK(SceMotion_sceMotionGetSensorState);
+    UNBIND_FUNC_HOOK(SceTouch_sceTouchRead);
+    UNBIND_FUNC_HOOK(SceTouch_sceTouchPeek);
 
-	//log_flush();
+    TRACE(DS_TRACE_USER_STOP, stateCacheHits, stateCacheMisses, sensorLostSamples);
 
     return SCE_KERNEL_STOP_SUCCESS;
 }
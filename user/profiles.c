@@ -0,0 +1,440 @@
+/*
+ *  DSMotion title profiles
+ *  Copyright (c) 2017 OperationNT
+ *
+ *  Permission is hereby granted, free of charge, to any person obtaining a copy
+ *  of this software and associated documentation files (the "Software"), to deal
+ *  in the Software without restriction, including without limitation the rights
+ *  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ *  copies of the Software, and to permit persons to whom the Software is
+ *  furnished to do so, subject to the following conditions:
+
+ *  The above copyright notice and this permission notice shall be included in all
+ *  copies or substantial portions of the Software.
+
+ *  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ *  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ *  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ *  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ *  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ *  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ *  SOFTWARE.
+ */
+#include <psp2/io/fcntl.h>
+#include <psp2/io/stat.h>
+#include <psp2/kernel/sysmem.h>
+
+#include <string.h>
+#include "profiles.h"
+
+/*
+ * Text file has one line per title: its ID followed by "key=value" settings, for example
+ *   PCSF00024 gyro=gx,-gz,-gy
+ * Binary cache is a header followed by an open addressing hash table of title entries:
+ * a lookup only reads the few entries from the title hash to the first empty one.
+ */
+
+#define PROFILES_DIR "ux0:data/dsmotion"
+
+#define PROFILES_MAGIC 0x50444D44 // "DMDP"
+#define PROFILES_VERSION 2
+
+#define PROFILES_MAX_BUCKETS 1024 // Must be a power of 2
+#define PROFILES_MIN_BUCKETS 16
+#define PROFILES_MAX_LINE 256
+
+#define TITLE_ID_SIZE 12
+
+struct profileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bucketCount;
+    unsigned int sourceSize;              // Text file it has been built from
+    SceDateTime sourceTime;
+    struct motionProfile defaults;        // Settings not given by the text file
+};
+
+struct profileEntry
+{
+    char titleId[TITLE_ID_SIZE];          // Empty for a free bucket
+    struct motionProfile profile;
+};
+
+static unsigned int hashTitleId(const char iTitleId[TITLE_ID_SIZE])
+{
+    // FNV-1a
+    unsigned int hash = 0x811C9DC5;
+    for (int i = 0 ; i < TITLE_ID_SIZE && 0 != iTitleId[i] ; i++)
+        hash = (hash ^ (unsigned char)iTitleId[i]) * 0x01000193;
+    return hash;
+}
+
+static void copyTitleId(char oTitleId[TITLE_ID_SIZE], const char* iTitleId, int iLength)
+{
+    memset(oTitleId, 0, TITLE_ID_SIZE);
+    if (iLength > TITLE_ID_SIZE-1)
+        iLength = TITLE_ID_SIZE-1;
+    memcpy(oTitleId, iTitleId, iLength);
+}
+
+/* Text parsing */
+
+static int isBlank(char c)
+{
+    return ' ' == c || '\t' == c || '\r' == c;
+}
+
+static int matchWord(const char* iStart, const char* iEnd, const char* iWord)
+{
+    int length = strlen(iWord);
+    return (iEnd - iStart) == length && 0 == memcmp(iStart, iWord, length);
+}
+
+static int parseUInt(const char* iStart, const char* iEnd, unsigned int* oValue)
+{
+    if (iStart == iEnd)
+        return 0;
+
+    unsigned int value = 0;
+    for (const char* c = iStart ; c < iEnd ; c++)
+    {
+        if (*c < '0' || *c > '9')
+            return 0;
+        value = value * 10 + (*c - '0');
+    }
+
+    *oValue = value;
+    return 1;
+}
+
+// Three components like "-az,ax,-ay" for SceMotion x, y and z
+static int parseAxes(const char* iStart, const char* iEnd, unsigned char oSource[3], signed char oSign[3])
+{
+    const char* c = iStart;
+    for (int i = 0 ; i < 3 ; i++)
+    {
+        signed char sign = 1;
+        if (c < iEnd && '-' == *c)
+        {
+            sign = -1;
+            c++;
+        }
+
+        if (iEnd - c < 2 || ('a' != c[0] && 'g' != c[0]) || c[1] < 'x' || c[1] > 'z')
+            return 0;
+
+        oSource[i] = (('g' == c[0]) ? 3 : 0) + (c[1] - 'x');
+        oSign[i] = sign;
+        c += 2;
+
+        if (i < 2 && (c >= iEnd || ',' != *c++))
+            return 0;
+    }
+
+    return c == iEnd;
+}
+
+static void parseSetting(const char* iKey, const char* iKeyEnd, const char* iValue, const char* iValueEnd, struct motionProfile* ioProfile)
+{
+    unsigned int number;
+
+    if (matchWord(iKey, iKeyEnd, "filter"))
+    {
+        if (matchWord(iValue, iValueEnd, "box"))
+            ioProfile->filter.type = DS_FILTER_BOX;
+        else if (matchWord(iValue, iValueEnd, "ema"))
+            ioProfile->filter.type = DS_FILTER_EMA;
+        else if (matchWord(iValue, iValueEnd, "damped"))
+            ioProfile->filter.type = DS_FILTER_CRITICALLY_DAMPED;
+        else if (matchWord(iValue, iValueEnd, "oneeuro"))
+            ioProfile->filter.type = DS_FILTER_ONE_EURO;
+    }
+    else if (matchWord(iKey, iKeyEnd, "time"))
+    {
+        if (parseUInt(iValue, iValueEnd, &number))
+            ioProfile->filter.timeConstantUS = number;
+    }
+    else if (matchWord(iKey, iKeyEnd, "mincutoff"))
+    {
+        if (parseUInt(iValue, iValueEnd, &number))
+            ioProfile->filter.minCutoffMilliHz = number;
+    }
+    else if (matchWord(iKey, iKeyEnd, "beta"))
+    {
+        if (parseUInt(iValue, iValueEnd, &number))
+            ioProfile->filter.beta = number;
+    }
+    else if (matchWord(iKey, iKeyEnd, "accel") || matchWord(iKey, iKeyEnd, "gyro"))
+    {
+        int first = ('g' == *iKey) ? 3 : 0;
+        unsigned char source[3];
+        signed char sign[3];
+        if (parseAxes(iValue, iValueEnd, source, sign))
+        {
+            memcpy(&ioProfile->axisSource[first], source, sizeof(source));
+            memcpy(&ioProfile->axisSign[first], sign, sizeof(sign));
+        }
+    }
+    else if (matchWord(iKey, iKeyEnd, "orientation"))
+    {
+        if (matchWord(iValue, iValueEnd, "fusion"))
+            ioProfile->orientation = ORIENTATION_FUSION;
+        else if (matchWord(iValue, iValueEnd, "tilt"))
+            ioProfile->orientation = ORIENTATION_TILT;
+    }
+    else if (matchWord(iKey, iKeyEnd, "euler"))
+    {
+        if (parseUInt(iValue, iValueEnd, &number))
+            ioProfile->eulerAngles = (0 != number);
+    }
+    else if (matchWord(iKey, iKeyEnd, "touch"))
+    {
+        if (matchWord(iValue, iValueEnd, "front"))
+            ioProfile->touchPanel = TOUCH_PANEL_FRONT;
+        else if (matchWord(iValue, iValueEnd, "back"))
+            ioProfile->touchPanel = TOUCH_PANEL_BACK;
+        else if (matchWord(iValue, iValueEnd, "none"))
+            ioProfile->touchPanel = TOUCH_PANEL_NONE;
+    }
+    else if (matchWord(iKey, iKeyEnd, "resample"))
+    {
+        if (parseUInt(iValue, iValueEnd, &number))
+            ioProfile->resamplingPeriod = number;
+    }
+}
+
+// Returns 1 if the line gives a profile (unknown settings are ignored)
+static int parseLine(const char* iLine, const char* iEnd, const struct motionProfile* iDefault, struct profileEntry* oEntry)
+{
+    const char* c = iLine;
+    while (c < iEnd && isBlank(*c))
+        c++;
+
+    const char* title = c;
+    while (c < iEnd && !isBlank(*c))
+        c++;
+
+    if (title == c || '#' == *title)
+        return 0;
+
+    copyTitleId(oEntry->titleId, title, c - title);
+    oEntry->profile = *iDefault;
+
+    while (c < iEnd)
+    {
+        while (c < iEnd && isBlank(*c))
+            c++;
+
+        const char* key = c;
+        const char* equal = NULL;
+        while (c < iEnd && !isBlank(*c))
+        {
+            if (NULL == equal && '=' == *c)
+                equal = c;
+            c++;
+        }
+
+        if (NULL != equal)
+            parseSetting(key, equal, equal+1, c, &oEntry->profile);
+    }
+
+    return 1;
+}
+
+/* Binary cache */
+
+static int insertEntry(struct profileEntry* ioBuckets, unsigned int iBucketCount, const struct profileEntry* iEntry)
+{
+    unsigned int mask = iBucketCount-1;
+    unsigned int index = hashTitleId(iEntry->titleId) & mask;
+
+    for (unsigned int probe = 0 ; probe < iBucketCount ; probe++, index = (index+1) & mask)
+    {
+        struct profileEntry* bucket = &ioBuckets[index];
+        // Last line of a title wins
+        if (0 == bucket->titleId[0] || 0 == memcmp(bucket->titleId, iEntry->titleId, TITLE_ID_SIZE))
+        {
+            *bucket = *iEntry;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int countLines(SceUID iFd)
+{
+    char buffer[PROFILES_MAX_LINE];
+    int nbLines = 1;
+    int nbRead;
+    while ((nbRead = sceIoRead(iFd, buffer, sizeof(buffer))) > 0)
+    {
+        for (int i = 0 ; i < nbRead ; i++)
+            nbLines += ('\n' == buffer[i]);
+    }
+    return nbLines;
+}
+
+/*
+ * Parses the whole text file into hash buckets and writes them to the cache file.
+ * Profile of the requested title is picked during the parsing: a cache which can't be written is not an issue.
+ */
+static int buildCache(const SceIoStat* iStat, const char iTitleId[TITLE_ID_SIZE], const struct motionProfile* iDefault, struct motionProfile* oProfile)
+{
+    SceUID fd = sceIoOpen(PROFILES_TEXT_PATH, SCE_O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    // Table stays at most half full
+    unsigned int bucketCount = PROFILES_MIN_BUCKETS;
+    unsigned int nbLines = countLines(fd);
+    while (bucketCount < PROFILES_MAX_BUCKETS && bucketCount < 2*nbLines)
+        bucketCount *= 2;
+
+    unsigned int tableSize = (bucketCount * sizeof(struct profileEntry) + 0xFFF) & ~0xFFF;
+    SceUID block = sceKernelAllocMemBlock("dsmotion_profiles", SCE_KERNEL_MEMBLOCK_TYPE_USER_RW, tableSize, NULL);
+    struct profileEntry* buckets = NULL;
+    if (block < 0 || sceKernelGetMemBlockBase(block, (void**)&buckets) < 0)
+    {
+        if (block >= 0)
+            sceKernelFreeMemBlock(block);
+        sceIoClose(fd);
+        return 0;
+    }
+    memset(buckets, 0, tableSize);
+
+    int found = 0;
+    int complete = 1;
+    char line[PROFILES_MAX_LINE];
+    int lineLength = 0;
+    char buffer[PROFILES_MAX_LINE];
+    int nbRead;
+
+    sceIoLseek(fd, 0, SCE_SEEK_SET);
+    do
+    {
+        nbRead = sceIoRead(fd, buffer, sizeof(buffer));
+        for (int i = 0 ; i <= nbRead ; i++)
+        {
+            // End of file ends the last line
+            int endOfLine = (i == nbRead) ? (nbRead <= 0) : ('\n' == buffer[i]);
+            if (!endOfLine)
+            {
+                if (i < nbRead && lineLength < PROFILES_MAX_LINE)
+                    line[lineLength++] = buffer[i];
+                continue;
+            }
+
+            struct profileEntry entry;
+            if (parseLine(line, &line[lineLength], iDefault, &entry))
+            {
+                complete &= insertEntry(buckets, bucketCount, &entry);
+                if (0 == memcmp(entry.titleId, iTitleId, TITLE_ID_SIZE))
+                {
+                    *oProfile = entry.profile;
+                    found = 1;
+                }
+            }
+            lineLength = 0;
+        }
+    }
+    while (nbRead > 0);
+
+    sceIoClose(fd);
+
+    if (complete)
+    {
+        sceIoMkdir(PROFILES_DIR, 0777);
+
+        fd = sceIoOpen(PROFILES_CACHE_PATH, SCE_O_WRONLY | SCE_O_CREAT | SCE_O_TRUNC, 0777);
+        if (fd >= 0)
+        {
+            struct profileHeader header;
+            memset(&header, 0, sizeof(header));
+            header.magic = PROFILES_MAGIC;
+            header.version = PROFILES_VERSION;
+            header.bucketCount = bucketCount;
+            header.sourceSize = (unsigned int)iStat->st_size;
+            header.sourceTime = iStat->st_mtime;
+            header.defaults = *iDefault;
+
+            sceIoWrite(fd, &header, sizeof(header));
+            sceIoWrite(fd, buckets, bucketCount * sizeof(struct profileEntry));
+            sceIoClose(fd);
+        }
+    }
+
+    sceKernelFreeMemBlock(block);
+    return found;
+}
+
+/*
+ * Looks the title up in the cache file.
+ * Returns 1 if found, 0 if not found and -1 if the cache doesn't match the text file.
+ */
+static int readCache(const SceIoStat* iStat, const char iTitleId[TITLE_ID_SIZE], const struct motionProfile* iDefault, struct motionProfile* oProfile)
+{
+    SceUID fd = sceIoOpen(PROFILES_CACHE_PATH, SCE_O_RDONLY, 0);
+    if (fd < 0)
+        return -1;
+
+    struct profileHeader header;
+    if (sceIoRead(fd, &header, sizeof(header)) != sizeof(header)
+     || PROFILES_MAGIC != header.magic || PROFILES_VERSION != header.version
+     || header.bucketCount > PROFILES_MAX_BUCKETS || 0 == header.bucketCount || 0 != (header.bucketCount & (header.bucketCount-1))
+     || (unsigned int)iStat->st_size != header.sourceSize || 0 != memcmp(&iStat->st_mtime, &header.sourceTime, sizeof(header.sourceTime))
+     || 0 != memcmp(iDefault, &header.defaults, sizeof(header.defaults)))
+    {
+        sceIoClose(fd);
+        return -1;
+    }
+
+    unsigned int mask = header.bucketCount-1;
+    unsigned int index = hashTitleId(iTitleId) & mask;
+    int result = 0;
+
+    for (unsigned int probe = 0 ; probe < header.bucketCount ; probe++, index = (index+1) & mask)
+    {
+        struct profileEntry entry;
+        sceIoLseek(fd, sizeof(header) + index * sizeof(entry), SCE_SEEK_SET);
+        if (sceIoRead(fd, &entry, sizeof(entry)) != sizeof(entry))
+        {
+            result = -1;
+            break;
+        }
+
+        if (0 == entry.titleId[0])
+            break;
+
+        if (0 == memcmp(entry.titleId, iTitleId, TITLE_ID_SIZE))
+        {
+            *oProfile = entry.profile;
+            result = 1;
+            break;
+        }
+    }
+
+    sceIoClose(fd);
+    return result;
+}
+
+int loadProfile(const char* iTitleId, const struct motionProfile* iDefault, struct motionProfile* oProfile)
+{
+    *oProfile = *iDefault;
+
+    char titleId[TITLE_ID_SIZE];
+    copyTitleId(titleId, iTitleId, strlen(iTitleId));
+    if (0 == titleId[0])
+        return 0;
+
+    SceIoStat stat;
+    if (sceIoGetstat(PROFILES_TEXT_PATH, &stat) < 0)
+        return 0;
+
+    int result = readCache(&stat, titleId, iDefault, oProfile);
+    if (result < 0)
+        result = buildCache(&stat, titleId, iDefault, oProfile);
+
+    return result;
+}
@@ -0,0 +1,38 @@
+#ifndef Profiles_H
+#define Profiles_H
+
+#include "../DSMotionLibrary.h"
+
+#define PROFILES_TEXT_PATH  "ux0:data/dsmotion/profiles.txt"
+#define PROFILES_CACHE_PATH "ux0:data/dsmotion/profiles.bin"
+
+#define ORIENTATION_FUSION 0 // Gyroscope integration corrected by gravity
+#define ORIENTATION_TILT   1 // Gravity only (no rotation around vertical axis)
+
+#define TOUCH_PANEL_FRONT 0
+#define TOUCH_PANEL_BACK  1
+#define TOUCH_PANEL_NONE  0xFF
+
+// Source components of SceMotion axes: accelerometer x, y, z then gyroscope x, y, z
+#define AXIS_SOURCE_COUNT 6
+
+struct motionProfile
+{
+    struct dsFilterParams filter;                 // sceMotionGetState values smoothing
+    unsigned char axisSource[AXIS_SOURCE_COUNT];  // Source component of each SceMotion axis (acceleration then angular velocity)
+    signed char axisSign[AXIS_SOURCE_COUNT];
+    unsigned char orientation;                    // ORIENTATION_*
+    unsigned char eulerAngles;                    // Gravity alignment from Euler angles (smoother but some movements are ignored)
+    unsigned char touchPanel;                     // TOUCH_PANEL_* given the DS4 touchpad
+    unsigned char reserved;
+    unsigned int resamplingPeriod;                // sceMotionGetSensorState records spacing (in microseconds), 0 for real samples
+};
+
+/*
+ * Settings of the given title: "oProfile" gets "iDefault" overridden by the title line of the text file.
+ * The text file is only parsed when it has changed, into a binary cache looked up by title hash.
+ * Returns 1 if the title has a profile.
+ */
+int loadProfile(const char* iTitleId, const struct motionProfile* iDefault, struct motionProfile* oProfile);
+
+#endif